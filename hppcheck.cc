@@ -0,0 +1,138 @@
+/*
+ * hppcheck.cc - Checks the C++ adapters in mm.hpp against the malloc
+ *               package, for make check.
+ *
+ * Grows std::vectors on mm::allocator (for an ordinary and an over-aligned
+ * element type) and takes over-aligned blocks from mm::resource(), small
+ * and large enough to be mapped on their own, checking alignment, that
+ * contents survive, and the heap after every step. Prints what failed and
+ * exits 1, or exits 0 silently.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <memory_resource>
+
+#include "memlib.h"
+#include "mm.hpp"
+
+/* An element type that needs more than malloc_alignment */
+struct alignas(64) line
+{
+    unsigned char bytes[64];
+};
+
+/*
+ * check - Report and exit unless ok; also checks the heap.
+ */
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        std::fprintf(stderr, "hppcheck: %s\n", what);
+        std::exit(1);
+    }
+    if (mm_checkheap() != 0) {
+        std::fprintf(stderr, "hppcheck: heap inconsistent after %s\n", what);
+        std::exit(1);
+    }
+}
+
+static bool aligned(const void *p, std::size_t alignment)
+{
+    return reinterpret_cast<std::uintptr_t>(p) % alignment == 0;
+}
+
+/*
+ * check_vectors - Grow, copy and shrink vectors on mm::allocator.
+ */
+static void check_vectors()
+{
+    std::vector<int, mm::allocator<int>> v;
+
+    for (int i = 0; i < 100000; i++) {
+        v.push_back(i);
+    }
+    std::vector<int, mm::allocator<int>> copy(v);
+
+    v.resize(10);
+    v.shrink_to_fit();
+
+    bool intact = copy.size() == 100000;
+    for (int i = 0; intact && i < 100000; i++) {
+        intact = copy[i] == i;
+    }
+    check(intact && v.size() == 10 && v[9] == 9, "vector<int> contents");
+
+    std::vector<line, mm::allocator<line>> lines;
+
+    for (int i = 0; i < 1000; i++) {
+        lines.emplace_back();
+        std::memset(lines.back().bytes, i & 0xff, sizeof(line));
+        check(aligned(lines.data(), alignof(line)), "vector<line> alignment");
+    }
+
+    intact = true;
+    for (int i = 0; intact && i < 1000; i++) {
+        intact = lines[i].bytes[0] == (i & 0xff) && lines[i].bytes[63] == (i & 0xff);
+    }
+    check(intact, "vector<line> contents");
+}
+
+/*
+ * check_resource - Over-aligned allocate/deallocate on mm::resource(),
+ *                  directly and as the upstream of a pmr pool.
+ */
+static void check_resource()
+{
+    static const std::size_t sizes[] = { 1, 100, 5000, 200 << 10 };
+    static const std::size_t alignments[] = { 32, 64, 4096, 1 << 16 };
+    std::pmr::memory_resource *r = mm::resource();
+    void *blocks[4][4];
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            void *p = r->allocate(sizes[i], alignments[j]);
+
+            check(aligned(p, alignments[j]), "resource allocate alignment");
+            std::memset(p, i * 4 + j, sizes[i]);
+            blocks[i][j] = p;
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            const unsigned char *p = static_cast<unsigned char *>(blocks[i][j]);
+
+            check(p[0] == i * 4 + j && p[sizes[i] - 1] == i * 4 + j, "resource contents");
+            r->deallocate(blocks[i][j], sizes[i], alignments[j]);
+            check(true, "resource deallocate");
+        }
+    }
+
+    check(r->is_equal(mm::memory_resource()), "resource equality");
+
+    std::pmr::unsynchronized_pool_resource pool(r);
+    std::pmr::vector<std::pmr::vector<char>> nested(&pool);
+
+    for (int i = 0; i < 2000; i++) {
+        nested.emplace_back(i % 300, char(i));
+    }
+    check(nested[1999].size() == 1999 % 300 && nested[1999].back() == char(1999), "pmr pool contents");
+}
+
+int main()
+{
+    mem_init();
+    if (mm_init() < 0) {
+        std::fprintf(stderr, "hppcheck: mm_init failed\n");
+        return 1;
+    }
+
+    check_vectors();
+    check_resource();
+    check(true, "containers destroyed");
+
+    return 0;
+}
@@ -0,0 +1,1053 @@
+/*
+ * mdriver.c - Trace-driven driver for the malloc package.
+ *
+ * Replays allocation traces against mm.c and against the C library's
+ * malloc. For every trace it first does one checked replay with mm.c,
+ * which verifies that each block is aligned, keeps its contents and does
+ * not overlap another block, and measures:
+ *
+ *   heap    peak size of the mem_sbrk heap
+ *   peak    peak mm_footprint(), which also counts slab runs and blocks
+ *           mapped on their own
+ *   util    space utilization: peak live payload / peak
+ *
+ * It then times the trace a number of times with each allocator and
+ * reports the best run as thousands of operations per second. With -s,
+ * and mm.c built with MM_STATS, the checked replay is followed by the
+ * allocator's own statistics (see mm_stats).
+ *
+ * A trace is a text file with one request per line:
+ *
+ *     a <id> <size>    malloc size bytes as block id
+ *     c <id> <size>    calloc size bytes as block id
+ *     r <id> <size>    realloc block id to size bytes
+ *     f <id>           free block id
+ *     m <id> <size> <align>  memalign size bytes aligned to align, a
+ *                      power of two, as block id
+ *     A <id> <n> <size>  mm_malloc_batch n blocks of size bytes as blocks
+ *                      id to id + n - 1
+ *     F <id> <n>       mm_free_batch blocks id to id + n - 1; any of them
+ *                      may be unallocated
+ *     g <id> <size>    mm_region_alloc size bytes as block id from the
+ *                      trace's region, created with default chunks on
+ *                      first use; region blocks are not freed one by one
+ *     M                mm_region_mark the region
+ *     R                mm_region_rollback the region to the newest mark
+ *                      not yet rolled back to, freeing the blocks since
+ *     Z                mm_region_reset the region: free all its blocks
+ *                      and forget every mark
+ *
+ * Blank lines, lines starting with '#' and lines holding only a number
+ * are skipped, so CS:APP traces replay as they are, header included.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+// Default number of timed replays per trace and allocator
+#define DEFAULT_REPS 5
+
+/* One request of a trace */
+typedef struct
+{
+    char type;          // 'a', 'c', 'r', 'f', 'm', 'A', 'F', 'g', 'M', 'R' or 'Z'
+    unsigned id;
+    size_t size;
+    size_t align;       // Alignment of an 'm' request
+    unsigned count;     // Blocks of an 'A' or 'F' request, from id on; 1 otherwise
+} op_t;
+
+typedef struct
+{
+    const char *name;
+    op_t *ops;
+    size_t nops;
+    unsigned nids;      // ids run from 0 to nids - 1
+    bool region;        // Whether it has region requests
+    unsigned marks;     // Most region marks outstanding at once
+} trace_t;
+
+/* An allocator under test */
+typedef struct
+{
+    const char *name;
+    void (*reset)(void);
+    void *(*malloc)(size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*free)(void *ptr);
+    void *(*memalign)(size_t alignment, size_t size);
+    size_t (*malloc_batch)(size_t n, size_t size, void **ptrs);
+    void (*free_batch)(size_t n, void **ptrs);
+    mm_region_t *(*region_create)(size_t chunk_size);
+    void *(*region_alloc)(mm_region_t *region, size_t size);
+    mm_region_mark_t (*region_mark)(mm_region_t *region);
+    void (*region_rollback)(mm_region_t *region, mm_region_mark_t mark);
+    void (*region_reset)(mm_region_t *region);
+    void (*region_destroy)(mm_region_t *region);
+} allocator_t;
+
+/* What the checked replay measured */
+typedef struct
+{
+    size_t peak_heap;
+    size_t peak_footprint;
+    size_t peak_payload;
+} usage_t;
+
+static void mm_reset(void);
+static void libc_reset(void);
+static size_t libc_malloc_batch(size_t n, size_t size, void **ptrs);
+static void libc_free_batch(size_t n, void **ptrs);
+static mm_region_t *libc_region_create(size_t chunk_size);
+static void *libc_region_alloc(mm_region_t *region, size_t size);
+static mm_region_mark_t libc_region_mark(mm_region_t *region);
+static void libc_region_rollback(mm_region_t *region, mm_region_mark_t mark);
+static void libc_region_reset(mm_region_t *region);
+static void libc_region_destroy(mm_region_t *region);
+
+static const allocator_t mm_allocator = {
+    "mm", mm_reset, mm_malloc, mm_calloc, mm_realloc, mm_free, mm_memalign,
+    mm_malloc_batch, mm_free_batch,
+    mm_region_create, mm_region_alloc, mm_region_mark, mm_region_rollback,
+    mm_region_reset, mm_region_destroy
+};
+
+static const allocator_t libc_allocator = {
+    "libc", libc_reset, malloc, calloc, realloc, free, aligned_alloc,
+    libc_malloc_batch, libc_free_batch,
+    libc_region_create, libc_region_alloc, libc_region_mark, libc_region_rollback,
+    libc_region_reset, libc_region_destroy
+};
+
+static bool read_trace(const char *path, trace_t *trace);
+static bool check_trace(const trace_t *trace, bool check_heap, usage_t *usage);
+static double time_trace(const trace_t *trace, const allocator_t *alloc, int reps);
+static void print_stats(const struct mm_stats *before, const struct mm_stats *after);
+static double now(void);
+
+/*
+ * set_placement - Select the placement policy named by name for every
+ *                 mm_init to come. Returns false for an unknown name.
+ */
+static bool set_placement(const char *name)
+{
+    static const char *const names[] = {
+        [MM_PLACE_LIFO] = "lifo",
+        [MM_PLACE_FIFO] = "fifo",
+        [MM_PLACE_ADDRESS] = "address",
+        [MM_PLACE_NEXT_FIT] = "next",
+        [MM_PLACE_BEST_OF] = "best",
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return mm_mallopt(MM_PLACEMENT, i) == 0;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c] [-H] [-L] [-s] [-n reps] [-p policy] [-P bytes] trace...\n"
+            "  -c       run mm_checkheap after every request of the checked replay\n"
+            "  -H       back the heap with huge pages (see MM_HUGEPAGES)\n"
+            "  -L       do not time the C library's malloc\n"
+            "  -s       print mm_stats for the checked replay (needs -DMM_STATS)\n"
+            "  -n reps  timed replays per trace, best one counts (default %d)\n"
+            "  -p policy  free-list placement: lifo (default), fifo, address,\n"
+            "             next or best (see MM_PLACEMENT)\n"
+            "  -P bytes   run the heap profiler, one sample per bytes on average\n",
+            prog, DEFAULT_REPS);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bool check_heap = false;
+    bool with_libc = true;
+    bool show_stats = false;
+    int reps = DEFAULT_REPS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cHLsn:p:P:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            check_heap = true;
+            break;
+        case 'H':
+            mm_mallopt(MM_HUGEPAGES, 1);
+            break;
+        case 'L':
+            with_libc = false;
+            break;
+        case 's':
+            show_stats = true;
+            break;
+        case 'n':
+            reps = atoi(optarg);
+            if (reps < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'p':
+            if (!set_placement(optarg)) {
+                usage(argv[0]);
+            }
+            break;
+        case 'P':
+            if (mm_mallopt(MM_PROF_SAMPLE, strtoull(optarg, NULL, 0)) != 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+
+    mem_init();
+
+    printf("%-20s %8s %10s %10s %7s %11s %11s\n",
+           "trace", "ops", "heap KiB", "peak KiB", "util", "mm Kops/s", "libc Kops/s");
+
+    size_t total_ops = 0;
+    double total_mm = 0, total_libc = 0, total_util = 0;
+    int ntraces = 0;
+    bool failed = false;
+
+    for (int i = optind; i < argc; i++) {
+        trace_t trace;
+        usage_t use;
+        struct mm_stats before, after;
+
+        if (!read_trace(argv[i], &trace)) {
+            failed = true;
+            continue;
+        }
+
+        mm_stats(&before);
+
+        if (!check_trace(&trace, check_heap, &use)) {
+            printf("%-20s FAILED\n", trace.name);
+            failed = true;
+            free(trace.ops);
+            continue;
+        }
+
+        if (show_stats && mm_stats(&after) < 0) {
+            fprintf(stderr, "mm.c was built without MM_STATS\n");
+            show_stats = false;
+        }
+
+        double util = use.peak_footprint ? (double) use.peak_payload / use.peak_footprint : 1.0;
+        double mm_time = time_trace(&trace, &mm_allocator, reps);
+        double libc_time = with_libc ? time_trace(&trace, &libc_allocator, reps) : 0;
+
+        printf("%-20s %8zu %10zu %10zu %6.1f%% %11.0f ",
+               trace.name, trace.nops, use.peak_heap / 1024,
+               use.peak_footprint / 1024, 100 * util, trace.nops / mm_time / 1e3);
+        if (with_libc) {
+            printf("%11.0f\n", trace.nops / libc_time / 1e3);
+        } else {
+            printf("%11s\n", "-");
+        }
+
+        if (show_stats) {
+            print_stats(&before, &after);
+        }
+
+        total_ops += trace.nops;
+        total_mm += mm_time;
+        total_libc += libc_time;
+        total_util += util;
+        ntraces++;
+
+        free(trace.ops);
+    }
+
+    if (ntraces > 1) {
+        printf("%-20s %8zu %10s %10s %6.1f%% %11.0f ",
+               "total", total_ops, "", "", 100 * total_util / ntraces,
+               total_ops / total_mm / 1e3);
+        if (with_libc) {
+            printf("%11.0f\n", total_ops / total_libc / 1e3);
+        } else {
+            printf("%11s\n", "-");
+        }
+    }
+
+    mem_deinit();
+
+    return failed ? 1 : 0;
+}
+
+/*
+ * read_trace - Parse the trace at path into trace. Prints the problem and
+ *              returns false if the file cannot be read or is malformed.
+ */
+static bool read_trace(const char *path, trace_t *trace)
+{
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    const char *slash = strrchr(path, '/');
+
+    trace->name = (slash != NULL) ? slash + 1 : path;
+    trace->ops = NULL;
+    trace->nops = 0;
+    trace->nids = 0;
+    trace->region = false;
+    trace->marks = 0;
+
+    size_t cap = 0;
+    unsigned lineno = 0;
+    unsigned marks = 0;     // Region marks not yet rolled back to
+    char line[256];
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        op_t op = { 0 };
+        unsigned long long size = 0;
+        unsigned long long align = 16;
+        unsigned count = 1;
+        int fields;
+
+        lineno++;
+
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#' || isdigit((unsigned char) *p)) {
+            continue;
+        }
+
+        op.type = *p++;
+        switch (op.type) {
+        case 'a':
+        case 'c':
+        case 'r':
+            fields = sscanf(p, "%u %llu", &op.id, &size);
+            break;
+        case 'f':
+            fields = sscanf(p, "%u", &op.id) + 1;
+            break;
+        case 'm':
+            fields = sscanf(p, "%u %llu %llu", &op.id, &size, &align) - 1;
+            break;
+        case 'A':
+            fields = sscanf(p, "%u %u %llu", &op.id, &count, &size) - 1;
+            break;
+        case 'F':
+            fields = sscanf(p, "%u %u", &op.id, &count);
+            break;
+        case 'g':
+            fields = sscanf(p, "%u %llu", &op.id, &size);
+            break;
+        case 'M':
+        case 'Z':
+            fields = 2;
+            break;
+        case 'R':
+            fields = (marks > 0) ? 2 : 0;
+            break;
+        default:
+            fields = 0;
+        }
+
+        if (fields != 2 || count == 0 || count > UINT_MAX - op.id ||
+            align == 0 || (align & (align - 1)) != 0) {
+            fprintf(stderr, "%s:%u: malformed request\n", path, lineno);
+            fclose(fp);
+            free(trace->ops);
+            return false;
+        }
+
+        op.size = size;
+        op.count = count;
+        op.align = align;
+
+        if (strchr("gMRZ", op.type) != NULL) {
+            trace->region = true;
+        }
+        if (op.type == 'M' && ++marks > trace->marks) {
+            trace->marks = marks;
+        } else if (op.type == 'R') {
+            marks--;
+        } else if (op.type == 'Z') {
+            marks = 0;
+        }
+
+        if (trace->nops == cap) {
+            cap = cap ? 2 * cap : 1024;
+            trace->ops = realloc(trace->ops, cap * sizeof(op_t));
+            if (trace->ops == NULL) {
+                fprintf(stderr, "%s: out of memory\n", path);
+                exit(1);
+            }
+        }
+
+        trace->ops[trace->nops++] = op;
+        if (op.id + count > trace->nids) {
+            trace->nids = op.id + count;
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/*
+ * pattern - The byte block id is filled with, so that a block overwritten
+ *           by a neighbour or moved without its contents is noticed.
+ */
+static unsigned char pattern(unsigned id)
+{
+    return (unsigned char) (id * 167 + 13);
+}
+
+/*
+ * verify - Returns whether the first size bytes at p all equal c.
+ */
+static bool verify(const unsigned char *p, size_t size, unsigned char c)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != c) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * replay_t - State of the checked replay: what each block id holds.
+ */
+typedef struct
+{
+    const trace_t *trace;
+    unsigned char **ptrs;
+    size_t *sizes;
+    size_t payload;     // Bytes requested by the blocks now allocated
+
+    // The trace's region, which of the blocks came from it and in what
+    // order, and the marks taken with how many blocks it had then
+    mm_region_t *region;
+    bool *regional;
+    unsigned *region_ids;
+    unsigned region_count;
+    mm_region_mark_t *marks;
+    unsigned *mark_counts;
+    unsigned nmarks;
+} replay_t;
+
+/*
+ * check_intact - Returns whether block id still holds what it was filled
+ *                with; prints the problem if not. Op i is the request
+ *                about to touch it.
+ */
+static bool check_intact(replay_t *rp, size_t i, unsigned id)
+{
+    if (rp->ptrs[id] != NULL && !verify(rp->ptrs[id], rp->sizes[id], pattern(id))) {
+        fprintf(stderr, "%s: op %zu: block %u was overwritten\n", rp->trace->name, i, id);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_owned - Returns whether block id can be freed or reallocated by
+ *               itself, printing the problem if op i is about to and it
+ *               is a region block or has been overwritten.
+ */
+static bool check_owned(replay_t *rp, size_t i, unsigned id)
+{
+    if (rp->regional[id]) {
+        fprintf(stderr, "%s: op %zu: block %u belongs to the region\n", rp->trace->name, i, id);
+        return false;
+    }
+    return check_intact(rp, i, id);
+}
+
+/*
+ * check_free - Returns whether block id is free, printing the problem if
+ *              op i is about to allocate it while it is not.
+ */
+static bool check_free(replay_t *rp, size_t i, unsigned id)
+{
+    if (rp->ptrs[id] != NULL) {
+        fprintf(stderr, "%s: op %zu: block %u is already allocated\n", rp->trace->name, i, id);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * place_block - Check the size bytes at p that op i allocated as block id
+ *               (NULL only for 0 bytes), aligned to align or 16 bytes,
+ *               whichever is more, then fill them with its pattern and
+ *               record them.
+ */
+static bool place_block(replay_t *rp, size_t i, unsigned id, unsigned char *p, size_t size,
+                        size_t align)
+{
+    if (size != 0) {
+        if (p == NULL) {
+            fprintf(stderr, "%s: op %zu: allocating %zu bytes failed\n",
+                    rp->trace->name, i, size);
+            return false;
+        }
+        if ((uintptr_t) p % (align > 16 ? align : 16) != 0) {
+            fprintf(stderr, "%s: op %zu: block %u at %p is misaligned\n",
+                    rp->trace->name, i, id, (void *) p);
+            return false;
+        }
+    }
+
+    if (p != NULL) {
+        memset(p, pattern(id), size);
+        rp->ptrs[id] = p;
+        rp->sizes[id] = size;
+        rp->payload += size;
+    }
+    return true;
+}
+
+/*
+ * forget_block - Record that block id is no longer allocated.
+ */
+static void forget_block(replay_t *rp, unsigned id)
+{
+    rp->payload -= rp->sizes[id];
+    rp->ptrs[id] = NULL;
+    rp->sizes[id] = 0;
+    rp->regional[id] = false;
+}
+
+/*
+ * drop_region_blocks - Check and forget the region blocks allocated after
+ *                      the first count, newest first, before op i frees
+ *                      them. Returns false at the first one overwritten.
+ */
+static bool drop_region_blocks(replay_t *rp, size_t i, unsigned count)
+{
+    while (rp->region_count > count) {
+        unsigned id = rp->region_ids[--rp->region_count];
+
+        if (!check_intact(rp, i, id)) {
+            return false;
+        }
+        forget_block(rp, id);
+    }
+    return true;
+}
+
+/*
+ * check_trace - Replay a trace once with mm.c, checking every result and
+ *               recording peak usage. Prints what went wrong and returns
+ *               false on the first error.
+ */
+static bool check_trace(const trace_t *trace, bool check_heap, usage_t *usage)
+{
+    replay_t replay = { 0 };
+    replay_t *rp = &replay;
+    unsigned char **batch = malloc(trace->nids * sizeof(*batch));
+    bool ok = true;
+
+    rp->trace = trace;
+    rp->ptrs = calloc(trace->nids, sizeof(*rp->ptrs));
+    rp->sizes = calloc(trace->nids, sizeof(*rp->sizes));
+    rp->regional = calloc(trace->nids, sizeof(*rp->regional));
+    rp->region_ids = malloc(trace->nids * sizeof(*rp->region_ids));
+    rp->marks = malloc((trace->marks + 1) * sizeof(*rp->marks));
+    rp->mark_counts = malloc((trace->marks + 1) * sizeof(*rp->mark_counts));
+    if (rp->ptrs == NULL || rp->sizes == NULL || rp->regional == NULL ||
+        rp->region_ids == NULL || rp->marks == NULL || rp->mark_counts == NULL || batch == NULL) {
+        fprintf(stderr, "%s: out of memory\n", trace->name);
+        exit(1);
+    }
+
+    memset(usage, 0, sizeof(*usage));
+    mm_reset();
+
+    if (trace->region && (rp->region = mm_region_create(0)) == NULL) {
+        fprintf(stderr, "%s: creating the region failed\n", trace->name);
+        ok = false;
+    }
+
+    for (size_t i = 0; i < trace->nops && ok; i++) {
+        const op_t *op = &trace->ops[i];
+        unsigned char c = pattern(op->id);
+        unsigned char *p;
+        size_t got;
+
+        switch (op->type) {
+        case 'a':
+        case 'c':
+            if (!check_free(rp, i, op->id)) {
+                ok = false;
+                break;
+            }
+            p = (op->type == 'a') ? mm_malloc(op->size) : mm_calloc(1, op->size);
+            if (op->type == 'c' && p != NULL && !verify(p, op->size, 0)) {
+                fprintf(stderr, "%s: op %zu: calloc'd block %u is not zeroed\n",
+                        trace->name, i, op->id);
+                ok = false;
+                break;
+            }
+            ok = place_block(rp, i, op->id, p, op->size, op->align);
+            break;
+        case 'r':
+            if (!check_owned(rp, i, op->id)) {
+                ok = false;
+                break;
+            }
+            p = mm_realloc(rp->ptrs[op->id], op->size);
+            if (p != NULL && op->size != 0 &&
+                !verify(p, (op->size < rp->sizes[op->id]) ? op->size : rp->sizes[op->id], c)) {
+                fprintf(stderr, "%s: op %zu: realloc lost the contents of block %u\n",
+                        trace->name, i, op->id);
+                ok = false;
+                break;
+            }
+            forget_block(rp, op->id);
+            ok = place_block(rp, i, op->id, p, op->size, op->align);
+            break;
+        case 'f':
+            if (!check_owned(rp, i, op->id)) {
+                ok = false;
+                break;
+            }
+            mm_free(rp->ptrs[op->id]);
+            forget_block(rp, op->id);
+            break;
+        case 'm':
+            if (!check_free(rp, i, op->id)) {
+                ok = false;
+                break;
+            }
+            ok = place_block(rp, i, op->id, mm_memalign(op->align, op->size), op->size, op->align);
+            break;
+        case 'A':
+            for (unsigned id = op->id; id < op->id + op->count && ok; id++) {
+                ok = check_free(rp, i, id);
+            }
+            if (!ok) {
+                break;
+            }
+            got = mm_malloc_batch(op->count, op->size, (void **) batch);
+            if (got != (op->size != 0 ? op->count : 0)) {
+                fprintf(stderr, "%s: op %zu: batch got %zu of %u blocks of %zu bytes\n",
+                        trace->name, i, got, op->count, op->size);
+                ok = false;
+                break;
+            }
+            for (size_t k = 0; k < got && ok; k++) {
+                ok = place_block(rp, i, op->id + k, batch[k], op->size, op->align);
+            }
+            break;
+        case 'F':
+            // mm_free_batch reorders its array, so it gets a copy
+            for (unsigned k = 0; k < op->count && ok; k++) {
+                ok = check_owned(rp, i, op->id + k);
+                batch[k] = rp->ptrs[op->id + k];
+            }
+            if (!ok) {
+                break;
+            }
+            mm_free_batch(op->count, (void **) batch);
+            for (unsigned k = 0; k < op->count; k++) {
+                forget_block(rp, op->id + k);
+            }
+            break;
+        case 'g':
+            if (!check_free(rp, i, op->id)) {
+                ok = false;
+                break;
+            }
+            ok = place_block(rp, i, op->id, mm_region_alloc(rp->region, op->size), op->size,
+                             op->align);
+            rp->regional[op->id] = true;
+            rp->region_ids[rp->region_count++] = op->id;
+            break;
+        case 'M':
+            rp->marks[rp->nmarks] = mm_region_mark(rp->region);
+            rp->mark_counts[rp->nmarks++] = rp->region_count;
+            break;
+        case 'R':
+            rp->nmarks--;
+            ok = drop_region_blocks(rp, i, rp->mark_counts[rp->nmarks]);
+            if (ok) {
+                mm_region_rollback(rp->region, rp->marks[rp->nmarks]);
+            }
+            break;
+        case 'Z':
+            ok = drop_region_blocks(rp, i, 0);
+            if (ok) {
+                mm_region_reset(rp->region);
+                rp->nmarks = 0;
+            }
+            break;
+        }
+
+        if (!ok) {
+            break;
+        }
+
+        if (rp->payload > usage->peak_payload) {
+            usage->peak_payload = rp->payload;
+        }
+        size_t footprint = mm_footprint();
+        if (footprint > usage->peak_footprint) {
+            usage->peak_footprint = footprint;
+        }
+
+        if (check_heap && mm_checkheap() < 0) {
+            fprintf(stderr, "%s: op %zu: heap is inconsistent\n", trace->name, i);
+            ok = false;
+        }
+    }
+
+    usage->peak_heap = mem_heap_peak();
+
+    // The region's blocks go with it, checked unless something already failed
+    if (rp->region != NULL) {
+        if (ok) {
+            ok = drop_region_blocks(rp, trace->nops, 0);
+        }
+        while (rp->region_count > 0) {
+            forget_block(rp, rp->region_ids[--rp->region_count]);
+        }
+        mm_region_destroy(rp->region);
+
+        if (ok && check_heap && mm_checkheap() < 0) {
+            fprintf(stderr, "%s: heap is inconsistent after destroying the region\n", trace->name);
+            ok = false;
+        }
+    }
+
+    for (unsigned id = 0; id < trace->nids; id++) {
+        if (rp->ptrs[id] != NULL) {
+            mm_free(rp->ptrs[id]);
+        }
+    }
+
+    free(rp->ptrs);
+    free(rp->sizes);
+    free(rp->regional);
+    free(rp->region_ids);
+    free(rp->marks);
+    free(rp->mark_counts);
+    free(batch);
+
+    return ok;
+}
+
+/*
+ * time_trace - Replay a trace reps times with an allocator and return the
+ *              fastest run in seconds. Blocks still allocated at the end
+ *              are freed outside the timed part. The allocator is reset
+ *              only before the first run, so later runs reuse memory that
+ *              is already mapped in, as they would with the C library.
+ *              The region, if the trace has one, is likewise created and
+ *              destroyed outside it; its blocks are not kept in ptrs, as
+ *              only region requests free them.
+ */
+static double time_trace(const trace_t *trace, const allocator_t *alloc, int reps)
+{
+    void **ptrs = calloc(trace->nids, sizeof(*ptrs));
+    mm_region_mark_t *marks = malloc((trace->marks + 1) * sizeof(*marks));
+    double best = 0;
+
+    if (ptrs == NULL || marks == NULL) {
+        fprintf(stderr, "%s: out of memory\n", trace->name);
+        exit(1);
+    }
+
+    alloc->reset();
+
+    for (int rep = 0; rep < reps; rep++) {
+        mm_region_t *region = NULL;
+        unsigned nmarks = 0;
+
+        if (trace->region && (region = alloc->region_create(0)) == NULL) {
+            fprintf(stderr, "%s: creating a %s region failed\n", trace->name, alloc->name);
+            exit(1);
+        }
+
+        double start = now();
+
+        for (size_t i = 0; i < trace->nops; i++) {
+            const op_t *op = &trace->ops[i];
+
+            switch (op->type) {
+            case 'a':
+                ptrs[op->id] = alloc->malloc(op->size);
+                break;
+            case 'c':
+                ptrs[op->id] = alloc->calloc(1, op->size);
+                break;
+            case 'r':
+                ptrs[op->id] = alloc->realloc(ptrs[op->id], op->size);
+                break;
+            case 'f':
+                alloc->free(ptrs[op->id]);
+                ptrs[op->id] = NULL;
+                break;
+            case 'm':
+                ptrs[op->id] = alloc->memalign(op->align, op->size);
+                break;
+            case 'A':
+                alloc->malloc_batch(op->count, op->size, &ptrs[op->id]);
+                break;
+            case 'F':
+                alloc->free_batch(op->count, &ptrs[op->id]);
+                memset(&ptrs[op->id], 0, op->count * sizeof(*ptrs));
+                break;
+            case 'g':
+                alloc->region_alloc(region, op->size);
+                break;
+            case 'M':
+                marks[nmarks++] = alloc->region_mark(region);
+                break;
+            case 'R':
+                alloc->region_rollback(region, marks[--nmarks]);
+                break;
+            case 'Z':
+                alloc->region_reset(region);
+                nmarks = 0;
+                break;
+            }
+        }
+
+        double elapsed = now() - start;
+
+        if (region != NULL) {
+            alloc->region_destroy(region);
+        }
+
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+
+        for (unsigned id = 0; id < trace->nids; id++) {
+            alloc->free(ptrs[id]);
+            ptrs[id] = NULL;
+        }
+    }
+
+    free(ptrs);
+    free(marks);
+
+    return best;
+}
+
+/*
+ * print_latency - Print the median, 99th percentile and worst bucket of
+ *                 the calls counted in after but not in before.
+ */
+static void print_latency(const char *name, const uint64_t *before, const uint64_t *after)
+{
+    uint64_t hist[MM_STATS_BUCKETS];
+    uint64_t calls = 0;
+
+    for (int i = 0; i < MM_STATS_BUCKETS; i++) {
+        hist[i] = after[i] - before[i];
+        calls += hist[i];
+    }
+
+    if (calls == 0) {
+        return;
+    }
+
+    int p50 = -1, p99 = -1, worst = 0;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < MM_STATS_BUCKETS; i++) {
+        seen += hist[i];
+        if (p50 < 0 && 2 * seen >= calls) {
+            p50 = i;
+        }
+        if (p99 < 0 && 100 * seen >= 99 * calls) {
+            p99 = i;
+        }
+        if (hist[i] != 0) {
+            worst = i;
+        }
+    }
+
+    printf("    %-6s %10" PRIu64 " calls  p50 < %" PRIu64 "  p99 < %" PRIu64
+           "  max < %" PRIu64 " cycles\n", name, calls,
+           (uint64_t) 1 << p50, (uint64_t) 1 << p99, (uint64_t) 1 << worst);
+}
+
+/*
+ * print_stats - Print what mm_stats counted between before and after.
+ *               The heap counters were reset by mm_init in between, so
+ *               only the latency histograms need the difference.
+ */
+static void print_stats(const struct mm_stats *before, const struct mm_stats *after)
+{
+    printf("    fit    %10" PRIu64 " searches  mean %.2f  max %" PRIu64 " blocks looked at\n",
+           after->fit_searches,
+           after->fit_searches ? (double) after->fit_steps / after->fit_searches : 0.0,
+           after->fit_max_steps);
+    printf("    extend %10" PRIu64 " calls  %" PRIu64 " bytes\n",
+           after->extend_calls, after->extend_bytes);
+    printf("    blocks %10" PRIu64 " coalesces  %" PRIu64 " splits\n",
+           after->coalesces, after->splits);
+    printf("    purge  %10" PRIu64 " calls  %zu bytes still purged\n",
+           after->purges, after->purged_bytes);
+    printf("    remote %10" PRIu64 " frees from other arenas' threads\n",
+           after->remote_frees);
+    printf("    huge   %10zu bytes of heap on huge pages\n", after->huge_bytes);
+    print_latency("malloc", before->malloc_cycles, after->malloc_cycles);
+    print_latency("free", before->free_cycles, after->free_cycles);
+}
+
+/*
+ * mm_reset - Start mm.c over on an empty heap.
+ */
+static void mm_reset(void)
+{
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+/*
+ * libc_reset - Nothing to do; every block was freed after the last run.
+ */
+static void libc_reset(void)
+{
+}
+
+/*
+ * libc_malloc_batch - mm_malloc_batch for the C library: one malloc each.
+ */
+static size_t libc_malloc_batch(size_t n, size_t size, void **ptrs)
+{
+    size_t count = 0;
+
+    while (count < n && (ptrs[count] = malloc(size)) != NULL) {
+        count++;
+    }
+    return count;
+}
+
+/*
+ * libc_free_batch - mm_free_batch for the C library: one free each.
+ */
+static void libc_free_batch(size_t n, void **ptrs)
+{
+    for (size_t i = 0; i < n; i++) {
+        free(ptrs[i]);
+    }
+}
+
+/*
+ * libc_region_t - The C library has no regions, so the libc_region_*
+ *                 functions stand in with one malloc per block, kept on a
+ *                 stack to free them in bulk. A mark is the stack's depth,
+ *                 held in mm_region_mark_t's top.
+ */
+typedef struct
+{
+    void **blocks;
+    size_t count;
+    size_t cap;
+} libc_region_t;
+
+static mm_region_t *libc_region_create(size_t chunk_size)
+{
+    (void) chunk_size;
+    return (mm_region_t *) calloc(1, sizeof(libc_region_t));
+}
+
+static void *libc_region_alloc(mm_region_t *region, size_t size)
+{
+    libc_region_t *lr = (libc_region_t *) region;
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (lr->count == lr->cap) {
+        size_t cap = lr->cap ? 2 * lr->cap : 1024;
+        void **blocks = realloc(lr->blocks, cap * sizeof(*blocks));
+
+        if (blocks == NULL) {
+            return NULL;
+        }
+        lr->blocks = blocks;
+        lr->cap = cap;
+    }
+
+    void *p = malloc(size);
+
+    if (p != NULL) {
+        lr->blocks[lr->count++] = p;
+    }
+    return p;
+}
+
+static mm_region_mark_t libc_region_mark(mm_region_t *region)
+{
+    mm_region_mark_t mark = { NULL, (void *) (uintptr_t) ((libc_region_t *) region)->count };
+
+    return mark;
+}
+
+static void libc_region_rollback(mm_region_t *region, mm_region_mark_t mark)
+{
+    libc_region_t *lr = (libc_region_t *) region;
+
+    while (lr->count > (uintptr_t) mark.top) {
+        free(lr->blocks[--lr->count]);
+    }
+}
+
+static void libc_region_reset(mm_region_t *region)
+{
+    mm_region_mark_t start = { NULL, NULL };
+
+    libc_region_rollback(region, start);
+}
+
+static void libc_region_destroy(mm_region_t *region)
+{
+    libc_region_reset(region);
+    free(((libc_region_t *) region)->blocks);
+    free(region);
+}
+
+/*
+ * now - Monotonic time in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,291 @@
+/*
+ * memlib.c - a module that simulates the memory system. Needed because it
+ *            allows us to interleave calls from the student's malloc package
+ *            with the system's malloc package in libc.
+ *
+ * The simulated heap is one large reservation made with MAP_NORESERVE, so
+ * only the pages below the break cost memory. mem_sbrk moves the break
+ * either way; memory given back by a negative increment is released with
+ * MADV_DONTNEED (or cleared), so memory the heap grows into always reads
+ * as zero.
+ *
+ * The reservation starts on a huge page boundary, and mem_hugepages backs
+ * it with huge pages: transparent ones where the kernel allows them,
+ * otherwise as much of it as the free hugetlbfs pool covers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+// Largest the simulated heap can grow (bytes)
+#define MAX_HEAP ((size_t) 1 << 32)
+
+/* private variables */
+static char *mem_start_brk;     // points to first byte of heap
+static char *mem_brk;           // points to last byte of heap plus one
+static char *mem_max_addr;      // largest legal heap address plus one
+static char *mem_peak_brk;      // highest mem_brk since the last reset
+static int mem_backing;         // MEM_PAGES_* the heap has now
+
+/*
+ * read_number - Returns the number at the start of a small file such as
+ *               a sysfs attribute, or 0 if it cannot be read.
+ */
+static size_t read_number(const char *path)
+{
+    char buf[32];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    return strtoull(buf, NULL, 10);
+}
+
+/*
+ * reserve - Map the whole reservation at addr (or anywhere, if addr is
+ *           NULL) with ordinary pages. Returns MAP_FAILED on failure.
+ */
+static void *reserve(void *addr)
+{
+    return mmap(addr, MAX_HEAP, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (addr ? MAP_FIXED : 0), -1, 0);
+}
+
+/*
+ * release - Give back the memory in [lo, hi), which is above the break,
+ *           so that it reads as zero when the heap grows into it again.
+ *           Whole pages are dropped with MADV_DONTNEED; a hugetlb mapping
+ *           only drops whole huge pages, so there hi is rounded up to one
+ *           (nothing past the break is live). What is left of the page
+ *           holding lo, and everything if the kernel refuses, is cleared.
+ */
+static void release(char *lo, char *hi)
+{
+    uintptr_t page = (mem_backing == MEM_PAGES_HUGETLB) ? mem_hugepagesize() : mem_pagesize();
+    char *first = (char *) (((uintptr_t) lo + page - 1) & ~(page - 1));
+    char *last = (char *) (((uintptr_t) hi + page - 1) & ~(page - 1));
+
+    if (first >= hi) {
+        memset(lo, 0, hi - lo);
+        return;
+    }
+
+    if (madvise(first, last - first, MADV_DONTNEED) != 0) {
+        first = hi;
+    }
+    memset(lo, 0, first - lo);
+}
+
+/*
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void)
+{
+    size_t huge = mem_hugepagesize();
+    char *start = mmap(NULL, MAX_HEAP + huge, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (start == MAP_FAILED) {
+        fprintf(stderr, "mem_init: mmap of %zu bytes failed\n", MAX_HEAP);
+        exit(1);
+    }
+
+    /* Keep the huge page aligned MAX_HEAP bytes of it */
+    char *aligned = (char *) (((uintptr_t) start + huge - 1) & ~(uintptr_t) (huge - 1));
+
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + MAX_HEAP, start + huge - aligned);
+
+    mem_start_brk = aligned;
+    mem_max_addr = mem_start_brk + MAX_HEAP;
+    mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
+    mem_backing = MEM_PAGES_SMALL;
+}
+
+/*
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk, MAX_HEAP);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_reset_brk(void)
+{
+    release(mem_start_brk, mem_brk);
+    mem_brk = mem_start_brk;
+    mem_peak_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Moves the break by incr
+ *            bytes (shrinking the heap if incr is negative) and returns
+ *            the old break, or (void *) -1 with errno ENOMEM if the new
+ *            break would leave the heap.
+ */
+void *mem_sbrk(intptr_t incr)
+{
+    char *old_brk = mem_brk;
+
+    if ((incr < 0 && -incr > mem_brk - mem_start_brk) ||
+        (incr > 0 && incr > mem_max_addr - mem_brk)) {
+        errno = ENOMEM;
+        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+        return (void *) -1;
+    }
+
+    if (incr < 0) {
+        release(mem_brk + incr, mem_brk);
+    }
+
+    mem_brk += incr;
+    if (mem_brk > mem_peak_brk) {
+        mem_peak_brk = mem_brk;
+    }
+
+    return (void *) old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(void)
+{
+    return (void *) mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(void)
+{
+    return (void *) (mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize(void)
+{
+    return (size_t) (mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_heap_peak() - returns the largest the heap has been (bytes) since
+ *                   mem_init or the last mem_reset_brk
+ */
+size_t mem_heap_peak(void)
+{
+    return (size_t) (mem_peak_brk - mem_start_brk);
+}
+
+/*
+ * mem_hugepages - Back the heap with huge pages (on) or ordinary ones.
+ *                 Transparent huge pages are preferred; where the kernel
+ *                 has them disabled, the start of the heap is mapped from
+ *                 the hugetlbfs pool instead, as far as its free pages
+ *                 reach (they are reserved up front, so touching them
+ *                 cannot fail). Returns the MEM_PAGES_* now in effect, or
+ *                 -1 if the heap is not empty.
+ */
+int mem_hugepages(bool on)
+{
+    if (mem_brk != mem_start_brk) {
+        return -1;
+    }
+
+    int want = MEM_PAGES_SMALL;
+
+    if (on) {
+        char mode[64] = "";
+        int fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY | O_CLOEXEC);
+
+        if (fd >= 0) {
+            ssize_t n = read(fd, mode, sizeof(mode) - 1);
+
+            close(fd);
+            mode[n > 0 ? n : 0] = '\0';
+        }
+        want = (mode[0] != '\0' && strstr(mode, "[never]") == NULL) ? MEM_PAGES_THP
+                                                                     : MEM_PAGES_HUGETLB;
+    }
+
+    if (want == mem_backing) {
+        return mem_backing;
+    }
+
+    /* Start over from a plain reservation, which drops any earlier advice */
+    if (mem_backing != MEM_PAGES_SMALL) {
+        if (reserve(mem_start_brk) == MAP_FAILED) {
+            return mem_backing;
+        }
+        mem_backing = MEM_PAGES_SMALL;
+        mem_max_addr = mem_start_brk + MAX_HEAP;
+    }
+
+    if (want == MEM_PAGES_THP && madvise(mem_start_brk, MAX_HEAP, MADV_HUGEPAGE) == 0) {
+        mem_backing = MEM_PAGES_THP;
+    } else if (want != MEM_PAGES_SMALL) {
+        size_t huge = mem_hugepagesize();
+        char path[96];
+
+        snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%zukB/free_hugepages",
+                 huge / 1024);
+
+        size_t len = read_number(path) * huge;
+
+        if (len > MAX_HEAP) {
+            len = MAX_HEAP;
+        }
+        if (len > 0 && mmap(mem_start_brk, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB,
+                            -1, 0) != MAP_FAILED) {
+            mem_backing = MEM_PAGES_HUGETLB;
+        }
+    }
+
+    return mem_backing;
+}
+
+/*
+ * mem_hugepagesize() - returns the size of a transparent huge page (2 MiB
+ *                      where the kernel does not say)
+ */
+size_t mem_hugepagesize(void)
+{
+    static size_t huge;
+
+    if (huge == 0) {
+        size_t size = read_number("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+
+        huge = (size != 0 && (size & (size - 1)) == 0) ? size : (size_t) 2 << 20;
+    }
+    return huge;
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(void)
+{
+    return (size_t) getpagesize();
+}
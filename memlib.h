@@ -0,0 +1,31 @@
+#ifndef MEMLIB_H
+#define MEMLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What backs the heap, as mem_hugepages reports it */
+enum { MEM_PAGES_SMALL, MEM_PAGES_THP, MEM_PAGES_HUGETLB };
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(intptr_t incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+size_t mem_pagesize(void);
+int mem_hugepages(bool on);
+size_t mem_hugepagesize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMLIB_H */
@@ -1,14 +1,50 @@
 
 
+#define _GNU_SOURCE     // mremap
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 #include <inttypes.h>
+#include <errno.h>
+
+#ifdef MM_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <execinfo.h>
+#include <time.h>
 
 #include "memlib.h"
 #include "mm.h"
 
+/*
+ * Build with -DMM_THREAD_SAFE to make the allocator usable from several
+ * threads: the heap is split into arenas, each guarded by its own mutex,
+ * threads are spread over the arenas round-robin, and each thread keeps a
+ * small cache (tcache) of recently freed small blocks so that most
+ * malloc/free pairs never take a lock. A block freed by a thread of
+ * another arena goes straight back if that arena's lock is free, and is
+ * otherwise pushed on the arena's lock-free remote-free stack, which the
+ * arena's threads drain when they next allocate and when they exit.
+ * Without it there is a single arena and none of the locking or caching
+ * code is compiled.
+ *
+ * Build with -DMM_STATS to collect the statistics mm_stats reports. The
+ * heap counters live in each arena and are updated under its lock; the
+ * malloc/free latency histograms are per thread. Without it the stats_*
+ * hooks are empty and compile away.
+ *
+ * The heap profiler is always compiled in and off until MM_PROF_SAMPLE is
+ * set; see prof_malloc.
+ */
+
 
 typedef uint64_t word_t;
 
@@ -20,9 +56,17 @@ static const size_t dsize = 2 * sizeof(word_t);
 
 /*
   Minimum useable block size (bytes):
-  two words for header & footer, two words for payload
+  a free block needs a header and its two 32-bit links. A free block of
+  this size (a mini block) has no room for a footer; the next block's
+  header carries the prev_mini bit instead.
 */
-static const size_t min_block_size = 4 * sizeof(word_t);
+static const size_t min_block_size = 2 * sizeof(word_t);
+
+// Most a heap may span (bytes): 2^32 free-list links at 16-byte granularity
+static const size_t link_span = (size_t) 1 << 36;
+
+// Largest request we accept; anything bigger would overflow adjust_size
+static const size_t max_request = SIZE_MAX / 2;
 
 /* Initial heap size (bytes), requires (chunksize % 16 == 0)
 */
@@ -31,18 +75,114 @@ static const size_t chunksize = (1 << 12);
 // Mask to extract allocated bit from header
 static const word_t alloc_mask = 0x1;
 
+// Mask to extract the previous block's allocated bit from header
+static const word_t prev_alloc_mask = 0x2;
+
+/*
+ * Mask to extract the fresh bit from header. A free block is fresh when it
+ * came straight from mem_sbrk and was never handed out, so apart from its
+ * free-list links and footer its payload is still the zero fill of new heap
+ * memory. malloc_block reports the bit to its caller and clears it, so
+ * allocated blocks never carry it.
+ */
+static const word_t fresh_mask = 0x4;
+
+/*
+ * Mask to extract the mmapped bit from header. Requests of at least
+ * mmap_threshold bytes get a private mapping of their own instead of a
+ * heap block; their header sits one word into the mapping, records the
+ * mapping length as the size and carries this bit, and mm_free unmaps them.
+ */
+static const word_t mmapped_mask = 0x8;
+
+/*
+ * Mask to extract the prev_mini bit from header: set when the previous
+ * block is a free mini block, which find_prev then steps back over
+ * instead of reading a footer. Only meaningful while prev_alloc is clear.
+ * The low four bits are taken, so it uses the top one.
+ */
+static const word_t prev_mini_mask = (word_t) 1 << 63;
+
+/*
+ * Mask to extract the sampled bit from header: set on an allocated block
+ * the heap profiler recorded, so that freeing it drops the record. Only
+ * set and cleared under the heap lock (or on a mapped block), because a
+ * neighbour's free rewrites the header under it too.
+ */
+static const word_t sampled_mask = (word_t) 1 << 62;
+
 /*
  * Assume: All block sizes are a multiple of 16
  * and so can use lower 4 bits for flags
  */
-static const word_t size_mask = ~(word_t) 0xF;
+static const word_t size_mask = ~(word_t) 0xF & ~((word_t) 3 << 62);
+
+/*
+ * Number of segregated free lists, which hold the free blocks smaller than
+ * tree_min. Sizes below seg_exact_limit get one exact class per 16 bytes;
+ * above it each power of two is split into two classes. Must stay <= 64 so
+ * that the non-empty bitmap fits in one word.
+ */
+#define SEG_CLASSES 34
+
+// Blocks smaller than this map to an exact size class (size / 16)
+static const size_t seg_exact_limit = 512;
+
+/*
+ * How the segregated lists order their blocks and which block find_fit
+ * takes is the arena's placement policy (MM_PLACE_* in mm.h), fixed when
+ * the arena is initialized:
+ *
+ *  - LIFO and FIFO push freed blocks on the head or the tail of their list
+ *    and take the first fit from the head.
+ *  - Address-ordered keeps each list sorted by address and takes the
+ *    first fit from the head, i.e. the lowest block that fits. Insertion
+ *    walks a skip list: besides the list itself (lane 0), a block may sit
+ *    on up to SKIP_LEVELS - 1 sparser express lanes, each holding about a
+ *    quarter of the blocks of the lane below. A block's lane count comes
+ *    from a hash of its address, capped by the room in its payload.
+ *  - Next-fit takes the first fit from a per-list roving pointer, which
+ *    then moves past the block taken, wrapping around at the end.
+ *  - Best-of-N looks at up to best_of fitting blocks and takes the
+ *    smallest.
+ *
+ * The tree above tree_min is best fit (lowest address among equals) under
+ * every policy.
+ */
+#define SKIP_LEVELS 4
 
 /*
-  All blocks have both headers and footers
+ * Free blocks of at least this size are kept in a red-black tree ordered
+ * by (size, address) instead of a list, so find_fit can take the best fit
+ * in O(log n). The tree nodes live in the free blocks' payloads.
+ */
+static const size_t tree_min = 1024;
+
+/*
+ * Freed blocks of at most quick_max bytes are not coalesced right away:
+ * they stay marked allocated and wait on an exact-size quick list of
+ * their arena, so that freeing and reallocating one size costs no merge
+ * and split. consolidate() frees them for real when a request misses, or
+ * when a free produces a block of quick_consolidate bytes or more, which
+ * means there is enough free memory around for merging to matter.
+ */
+#define QUICK_BINS 32
 
-  Both the header and the footer consist of a single word containing the
-  size and the allocation flag, where size is the total size of the block,
-  including header, (possibly payload), unused space, and footer
+static const size_t quick_max = 512;
+
+static const size_t quick_consolidate = 64 * 1024;
+
+/*
+  All blocks have headers; only free blocks have footers
+
+  The header is a single word containing the size, the allocation flag and
+  the allocation flag of the previous block, where size is the total size
+  of the block, including header, (possibly payload), unused space, and
+  footer. The footer of a free block repeats its size so that the next
+  block can find it; an allocated block uses that word as payload, and its
+  neighbour learns it is allocated from its own prev_alloc bit instead.
+  A free mini block (min_block_size bytes) has no room for a footer; the
+  next header's prev_mini bit tells find_prev its size instead.
 */
 
 typedef struct block block_t;
@@ -53,16 +193,42 @@ struct block
     /* Header contains: 
     *  a. size
     *  b. allocation flag 
+    *  c. allocation flag of the previous block
     */
     word_t header;
 
     union
     {
+        // Free list neighbours as heap-relative links (see block_link)
         struct
         {
-            block_t *prev;
-            block_t *next;
+            uint32_t prev;
+            uint32_t next;
         } links;
+
+        // The same links (lane 0) and the skip list's express lanes, for
+        // address-ordered placement; they fit where the tree node does
+        struct
+        {
+            uint32_t prev;
+            uint32_t next;
+        } lanes[SKIP_LEVELS];
+
+        // Allocated blocks held on a quick list or in a thread cache
+        block_t *chain;
+
+        // Free blocks of at least tree_min bytes
+        struct
+        {
+            block_t *child[2];  // left (smaller) and right (larger)
+            block_t *parent;
+            bool red;
+
+            // Interior pages purged (see purge_block), and when the
+            // block was put in the tree (coarse ms, see purge_tick)
+            uint32_t purged;
+            uint64_t freed_at;
+        } node;
         /*
         * We don't know what the size of the payload will be, so we will
         * declare it as a zero-length array.  This allows us to obtain a
@@ -83,439 +249,4552 @@ struct block
      */
 };
 
-/* Global variables */
+/*
+ * Requests of at most slab_max bytes are served from slab runs instead of
+ * the heap: slab_run_size-byte, slab_run_size-aligned runs cut into equal
+ * slots of one size class (16, 32, ... 128 bytes). Slots carry no header;
+ * a slot's run, and with it its size, is found by rounding its address
+ * down to the run boundary, and a per-run bitmap tracks which slots are
+ * free. Runs come from a dedicated reservation, so a pointer is known to
+ * be a slot by a range check alone.
+ */
+#define SLAB_CLASSES 8
 
-// Pointer to first block
-static block_t *heap_start = NULL;
+// Largest request (bytes) served from a slab
+static const size_t slab_max = SLAB_CLASSES * 16;
 
-// Pointer to the first block in the free list
-static block_t *free_list_head = NULL;
+// Size and alignment of a run (bytes)
+static const size_t slab_run_size = 1 << 12;
 
-/* Function prototypes for internal helper routines */
+// Virtual size of the slab reservation (bytes)
+static const size_t slab_span = (size_t) 1 << 32;
 
-static size_t max(size_t x, size_t y);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce_block(block_t *block);
-static void split_block(block_t *block, size_t asize);
+typedef struct slab_run slab_run_t;
 
-static size_t round_up(size_t size, size_t n);
-static word_t pack(size_t size, bool alloc);
+typedef struct arena arena_t;
 
-static size_t extract_size(word_t header);
-static size_t get_size(block_t *block);
+/* Header at the start of every slab run */
+struct slab_run
+{
+    // Neighbours on the arena's partial list for cls, or on a free-run list
+    slab_run_t *prev;
+    slab_run_t *next;
 
-static bool extract_alloc(word_t header);
-static bool get_alloc(block_t *block);
+    // Arena whose lock guards this run
+    arena_t *arena;
 
-static void write_header(block_t *block, size_t size, bool alloc);
-static void write_footer(block_t *block, size_t size, bool alloc);
+    // Slot size (bytes) and size class
+    uint32_t slot_size;
+    uint16_t cls;
 
-static block_t *payload_to_header(void *bp);
-static void *header_to_payload(block_t *block);
-static word_t *header_to_footer(block_t *block);
+    // Number of slots and how many of them are free
+    uint16_t nslots;
+    uint16_t nfree;
 
-static block_t *find_next(block_t *block);
-static word_t *find_prev_footer(block_t *block);
-static block_t *find_prev(block_t *block);
+    // Slots from this index up have never been handed out (still zero)
+    uint16_t untouched;
 
-static bool check_heap();
-static void examine_heap();
+    // When the run became empty (coarse ms), while on slab_dirty
+    uint64_t freed_at;
 
-static block_t *extend_heap(size_t size);
-static void insert_block(block_t *free_block);
-static void remove_block(block_t *free_block);
+    // Bit i is set iff slot i is free
+    uint64_t bitmap[4];
+};
 
-/* 
- * mm_init - Initialize the memory manager 
- */
-int mm_init(void)
+#ifdef MM_STATS
+/* Counters behind mm_stats, kept per arena and guarded by its lock */
+typedef struct arena_stats
 {
-    /* Create the initial empty heap */
-    word_t *start = (word_t *)(mem_sbrk(2*wsize));
-    if ((size_t)start == -1) {
-        printf("ERROR: mem_sbrk failed in mm_init, returning %p\n", start);
-        return -1;
-    }
-    
-    /* Prologue footer */
-    start[0] = pack(0, true);
-    /* Epilogue header */
-    start[1] = pack(0, true); 
+    // Free heap blocks and their total size
+    size_t free_blocks;
+    size_t free_bytes;
 
-    /* Heap starts with first "block header", currently the epilogue header */
-    heap_start = (block_t *) &(start[1]);
+    // Bytes of slab slots handed out
+    size_t slab_bytes;
 
-    /* Extend the empty heap with a free block of chunksize bytes */
-    block_t *free_block = extend_heap(chunksize);
-    if (free_block == NULL) {
-        printf("ERROR: extend_heap failed in mm_init, returning");
-        return -1;
-    }
+    // find_fit calls, free blocks they looked at, and the most in one call
+    uint64_t fit_searches;
+    uint64_t fit_steps;
+    uint64_t fit_max_steps;
 
-    /* Set the head of the free list to this new free block */
-    free_list_head = free_block;
-    free_list_head->payload.links.prev = NULL;
-    free_list_head->payload.links.next = NULL;
+    uint64_t extend_calls;
+    uint64_t extend_bytes;
 
-    return 0;
-}
+    // Merges with a free neighbour, and blocks split in two
+    uint64_t coalesces;
+    uint64_t splits;
 
-/* 
- * mm_malloc - Allocate a block with at least size bytes of payload 
+    // madvise calls made by purging
+    uint64_t purges;
+
+    // Blocks and slots freed by other arenas' threads, as drained
+    uint64_t remote_frees;
+} arena_stats_t;
+#endif
+
+/*
+ * An arena is an independent heap: its own run of memory, its own free
+ * lists and (in the thread-safe build) its own lock. The main arena grows
+ * through mem_sbrk; every other arena lives at the start of its own
+ * arena_region_size slice of one reservation, so the arena owning any
+ * block is found from the block's address alone.
  */
-void *mm_malloc(size_t size)
+struct arena
 {
-    size_t asize;      // Allocated block size
-    block_t *bp;        //I make a new block pointer
+    // Pointer to first block
+    block_t *heap_start;
 
-    if (size == 0) // Ignore spurious request
-        return NULL;
+    // Heads of the segregated free lists, indexed by size class
+    block_t *seg_lists[SEG_CLASSES];
 
-    // Too small block
-    if (size <= dsize) {        
-        asize = min_block_size;
-    } else {
-        // Round up and adjust to meet alignment requirements    
-        asize = round_up(size + dsize, dsize);
-    }
+    // Bit i is set iff seg_lists[i] is non-empty
+    uint64_t seg_bitmap;
 
-  // TODO: Implement mm_malloc.  You can change or remove any of the above
-  // code.  It is included as a suggestion of where to start.
-  // You will want to replace this return statement...
+    // Last block of each list, for FIFO insertion
+    block_t *seg_tails[SEG_CLASSES];
 
-  //Ok so I guess I need to find use find fit first.
-  //Now does the size need to be just asize, or should it be asize + sizeof(header) + sizeof(footer)?
-  //I don't think so because like, the header and footer are just part of the block. So asize should already account for them
-  //right?
-  
-  if((bp = find_fit(asize)) == NULL)  //If the heap has nothing free
-  {
-      bp = extend_heap(asize * 2);      //extend it by 2 so we have to extend it less
-  }
-   // insert_block(bp);  //Called this in extend so I don't need it here
-  
-  if(bp == NULL)
-  {
-      return NULL;
-  }
+    // Where the next search of each list starts, for next-fit
+    block_t *seg_rovers[SEG_CLASSES];
 
-  
-  write_header(bp, get_size(bp), 1);
-  write_footer(bp, get_size(bp), 1);
-                                
-  split_block(bp, asize);
+    // Heads of the express lanes 1.. of each list, for address order
+    block_t *seg_skips[SEG_CLASSES][SKIP_LEVELS - 1];
 
-  remove_block(bp);
+    // Placement policy (MM_PLACE_*)
+    int placement;
 
-  return header_to_payload(bp);         //This needs to just return since the return type is void.
+    // Root of the tree of free blocks of at least tree_min bytes
+    block_t *tree_root;
 
-}
+    // Quick lists, one per block size up to quick_max, chained through
+    // payload.chain
+    block_t *quick[QUICK_BINS];
 
+    // Slab runs with at least one free slot, per slab class
+    slab_run_t *slab_partial[SLAB_CLASSES];
 
-/* 
- * mm_free - Free a block 
+    // One empty run kept back for reuse instead of being released
+    slab_run_t *slab_spare;
+
+    // Further empty runs, newest first, kept until they decay
+    slab_run_t *slab_dirty;
+
+    // Bytes of free blocks' interior pages given back to the system
+    size_t purged_bytes;
+
+    // Coarse clock (ms) at the last look, when purge_arena last ran, and
+    // frees counted towards the next look
+    uint64_t purge_now;
+    uint64_t purge_last;
+    unsigned purge_ticks;
+
+    // How far the heap grows on the next miss, at least (see grow_heap)
+    size_t grow_next;
+
+    // What the break moves by and purging releases whole: the page size,
+    // or the huge page size if the heap is backed by huge pages
+    size_t grain;
+
+#ifdef MM_STATS
+    arena_stats_t stats;
+#endif
+
+#ifdef MM_THREAD_SAFE
+    // Guards everything above and the arena's heap itself
+    pthread_mutex_t lock;
+
+    // Blocks and slab slots of this arena freed by threads of other
+    // arenas, by payload address, chained through their first payload
+    // word. Pushed with a CAS and no lock; emptied by remote_drain.
+    void *remote;
+
+    // Threads assigned to the arena that have not exited. Once it drops
+    // to 0 nobody drains the remote stack, so remote_free stops pushing.
+    unsigned threads;
+
+    // Region arenas only: current break and end of the reservation
+    unsigned char *brk;
+    unsigned char *end;
+#endif
+};
+
+/* Global variables */
+
+// The arena backed by mem_sbrk; the only one in the single-threaded build
+#ifdef MM_THREAD_SAFE
+static arena_t main_arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+#else
+static arena_t main_arena;
+#endif
+
+// Requests of at least this many bytes are mapped on their own (mm_mallopt)
+static size_t mmap_threshold = 128 * 1024;
+
+// A free block this large at the top of a heap is mostly given back (mm_mallopt)
+static size_t trim_threshold = 128 * 1024;
+
+// Smallest and largest heap extension for a miss (mm_mallopt), see grow_heap
+static size_t grow_min = 4 * 1024;
+static size_t grow_max = 1024 * 1024;
+
+/*
+ * Free memory left untouched for decay_ms milliseconds is given back to
+ * the system: the interior pages of large free blocks (purge_block) and
+ * empty slab runs. Freeing and reusing memory within that time costs no
+ * madvise and no page faults. The clock is read once every
+ * purge_tick_mask + 1 frees that reach an arena, and a purge pass runs
+ * when decay_ms has passed since the last one, so memory goes back
+ * between one and two decay periods after it was freed.
  */
-void mm_free(void *bp)
+static size_t decay_ms = 1000;
+
+static const unsigned purge_tick_mask = 63;
+
+// Placement policy arenas take at their next initialization
+static int placement = MM_PLACE_LIFO;
+
+// Fitting blocks best-of-N placement looks at
+static size_t best_of = 8;
+
+/*
+ * Whether arenas initialized from now on are backed by huge pages
+ * (mm_mallopt MM_HUGEPAGES). Such an arena grows, trims and purges in
+ * whole huge pages, so that none of its huge pages is split.
+ */
+static bool hugepages = false;
+
+#ifdef MM_THREAD_SAFE
+
+// Upper bound on the number of arenas
+#define MAX_ARENAS 64
+
+/*
+ * Virtual size of each region arena. All regions are reserved together
+ * with MAP_NORESERVE, so only pages a heap actually reaches cost memory.
+ */
+static const size_t arena_region_size = (size_t) 1 << 32;
+
+// The reservation holding regions for arenas 1 .. arena_count - 1
+static unsigned char *regions_base = NULL;
+static size_t regions_span = 0;
+
+// Arenas in use; slot 0 is the main arena, others are created on demand
+static arena_t *arenas[MAX_ARENAS] = { &main_arena };
+
+// Number of arenas threads are spread over, fixed on first use
+static unsigned arena_count = 0;
+
+// Round-robin cursor for assigning threads to arenas
+static unsigned arena_next = 0;
+
+// Serializes arena creation
+static pthread_mutex_t arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The arena this thread allocates from
+static _Thread_local arena_t *thread_arena;
+
+/*
+ * Bumped by every mm_init. A thread cache filled under an older generation
+ * points into a heap that no longer exists and is dropped on next use.
+ */
+static unsigned heap_generation = 0;
+
+// Blocks up to this size (bytes) are cached per thread
+static const size_t tcache_max = 1024;
+
+// One cache bin per 16-byte block size from min_block_size to tcache_max
+#define TCACHE_BINS 64
+
+// Most blocks a bin holds before half of it is flushed back to the heap
+static const unsigned tcache_count = 16;
+
+// Blocks moved between a bin and the heap per lock acquisition
+static const unsigned tcache_batch = 8;
+
+/*
+ * Per-thread cache of small blocks. Cached blocks stay marked allocated in
+ * their headers, so the heap treats them as in use, and are chained
+ * through payload.chain.
+ */
+typedef struct tcache
 {
+    block_t *bins[TCACHE_BINS];
+    unsigned char counts[TCACHE_BINS];
 
-    if (bp == NULL)
-        return;
+    // Slab slots, chained through their first word
+    void *slots[SLAB_CLASSES];
+    unsigned char slot_counts[SLAB_CLASSES];
 
-    block_t *block = payload_to_header(bp);
+    unsigned generation;
+} tcache_t;
 
-    bool bpAlloc = get_alloc(block);    //Use this for if the alloc bit is 0 i just return, idk maybe makes it incrementally faster.
-   
-    size_t bpSize;                  
-    
-    bpSize = get_size(block);          //Get the size of the current block
-    
-   
+static _Thread_local tcache_t tcache;
 
-    if (bpAlloc == 0)               //Just leave if what they want to free is already free
-        return;
-    
-    
-    write_header(block, bpSize, 0);  //So i just keep the size and all the same, just change the alloc bit from true to false.
-    write_footer(block, bpSize, 0);
+// Flushes a thread's cache when it exits
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
 
-                                //So i don't call insert block here since i do it in coalesce_block
+#endif
 
-                                //Do i want to worry about having adjacent free blocks or should I leave that till i write coalesce?
-    
-    insert_block(block);
+// The slab reservation, and the first run never yet carved from it
+static unsigned char *slab_base = NULL;
+static unsigned char *slab_brk = NULL;
 
-    coalesce_block(block);
+// Released runs, already returned to the OS with MADV_DONTNEED
+static slab_run_t *slab_free_runs = NULL;
 
-    return;
-    // TODO: Implement mm_free
+// Bytes of runs on slab_free_runs, for mm_footprint
+static size_t slab_released = 0;
 
-}
+// Bytes of all mappings made by mmap_alloc, for mm_footprint
+static size_t mmap_bytes = 0;
 
+#ifdef MM_STATS
 /*
- * insert_block - Insert block at the head of the free list (e.g., LIFO policy)
+ * A thread's mm_malloc/mm_free latency histograms, written only by that
+ * thread. In the thread-safe build each thread's histograms are linked on
+ * latency_threads for mm_stats to add up, and are folded into
+ * latency_retired when the thread exits.
  */
-static void insert_block(block_t *free_block)
+typedef struct latency
 {
-    
-    if(free_list_head == NULL)  //If the list is currently empty
-    {
-        free_list_head = free_block;
-        free_list_head->payload.links.next = NULL;
-        free_list_head->payload.links.prev = NULL;
-        
-        return;
-    }
+    uint64_t malloc_cycles[MM_STATS_BUCKETS];
+    uint64_t free_cycles[MM_STATS_BUCKETS];
+#ifdef MM_THREAD_SAFE
+    struct latency *prev;
+    struct latency *next;
+    bool registered;
+#endif
+} latency_t;
+
+#ifdef MM_THREAD_SAFE
+static _Thread_local latency_t thread_latency;
+
+static latency_t *latency_threads = NULL;
+static latency_t latency_retired;
+
+// Guards latency_threads and latency_retired
+static pthread_mutex_t latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Retires a thread's histograms when it exits
+static pthread_key_t latency_key;
+static pthread_once_t latency_key_once = PTHREAD_ONCE_INIT;
+#else
+static latency_t thread_latency;
+#endif
+#endif
+
+#ifdef MM_THREAD_SAFE
+// Guards slab_brk and slab_free_runs
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-    free_block->payload.links.next = free_list_head;
-    free_block->payload.links.prev = NULL;
-    
-    free_list_head->payload.links.prev = free_block;
-    free_list_head = free_block;
+/*
+ * Heap profiler. With prof_period set (MM_PROF_SAMPLE), an allocation is
+ * sampled each time a thread's countdown of requested bytes runs out, and
+ * the countdown restarts at an exponentially distributed number of bytes
+ * with mean prof_period, so every byte has the same chance of being
+ * sampled. A sampled block records the call stack that asked for it;
+ * mm_prof_dump writes the live ones, per stack, for pprof.
+ */
+static size_t prof_period = 0;
 
-    return;
-  /* 
-    block_t *curr = free_list_head;
+// Countdown while the profiler is off: how often a thread checks again (bytes)
+static const int64_t prof_idle = (int64_t) 1 << 24;
 
-    while(curr->payload.links.next != NULL)
-    {
-        curr = curr->payload.links.next;
-    }
+// Frames kept per sampled stack
+#define PROF_DEPTH 32
 
-    curr->payload.links.next = free_block;
-    free_block->payload.links.next = NULL;
-    free_block->payload.links.prev = curr;
-    
-    return;
-    */
-                                            
-   
-	// TODO: Implement insert block on the free list
+// Distinct stacks and live sampled blocks the tables hold; powers of two
+#define PROF_STACKS 4096
+#define PROF_LIVE 65536
 
-}
+typedef struct prof_stack
+{
+    uint64_t hash;              // 0 for an unused entry
+    uint32_t depth;
+    void *pc[PROF_DEPTH];
+
+    // Sampled blocks still live and all ever sampled, with their requested bytes
+    size_t live_count;
+    size_t live_bytes;
+    size_t total_count;
+    size_t total_bytes;
+} prof_stack_t;
+
+typedef struct prof_live
+{
+    uintptr_t ptr;              // Payload address; 0 for an unused entry
+    size_t size;                // Bytes requested
+    uint32_t stack;             // Index into prof_stacks
+} prof_live_t;
+
+// Both tables are mapped on the first sample
+static prof_stack_t *prof_stacks = NULL;
+static prof_live_t *prof_lives = NULL;
+static size_t prof_live_count = 0;
+
+typedef struct prof_thread
+{
+    int64_t countdown;          // Bytes until the next sample; starts at 0 so the first call looks
+    uint64_t rng;               // xorshift state for the intervals
+    bool busy;                  // Taking a sample; nested calls (backtrace may allocate) are not
+} prof_thread_t;
+
+#ifdef MM_THREAD_SAFE
+static _Thread_local prof_thread_t prof_thread;
+
+// Guards the profiler's tables
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+static prof_thread_t prof_thread;
+#endif
 
 /*
- * remove_block - Remove a free block from the free list
+ * Regions (mm_region_create) bump-allocate from chunks, heap payloads
+ * taken with heap_payload and kept newest first. Freeing a region's
+ * objects means freeing its chunks, a handful of frees for any number of
+ * objects. Each new chunk is twice the size of the last, up to
+ * region_chunk_max, or as big as the request that needed it.
  */
-static void remove_block(block_t *free_block) 
+typedef struct region_chunk
 {
-   
+    struct region_chunk *next;  // Older chunk
+    size_t size;                // Bytes of the chunk, this header included
+} region_chunk_t;
 
-    if(free_block->payload.links.prev == NULL)  //If it's the first thing in the list
-    {
-        if(free_block->payload.links.next == NULL)  //If it's also the only thing in the list
-        {
-            free_block = NULL;   //New thing, this seems right
-            free_list_head = NULL; //This is new, now i just segfault instead of getting the payload overlaps, poggers?
+struct mm_region
+{
+    region_chunk_t *chunks;     // Newest first; allocation bumps through the first
+    unsigned char *top;         // Next free byte of chunks
+    unsigned char *end;         // End of chunks
+    size_t chunk_size;          // Size of the next chunk
+};
 
-            return;
-        }
-        else                                        //If it's not the only thing in the list
-        {
-            block_t *next_block = free_block->payload.links.next;
-            next_block->payload.links.prev = NULL;
-            free_list_head = next_block;
-            free_block = NULL;
-            return;
-        }
-    }
+// Default first chunk and the most chunks grow to (bytes)
+static const size_t region_chunk_min = (size_t) 16 << 10;
+static const size_t region_chunk_max = (size_t) 1 << 20;
 
+/* Function prototypes for internal helper routines */
 
-    if((free_block->payload.links.next == NULL) && (free_block->payload.links.prev != NULL))  //If it's the last thing in the last
-    {
-        block_t *prev_block = free_block->payload.links.prev;   
-        prev_block->payload.links.next = NULL;
-        free_block = NULL;  
-        return;
-    }
-    
-    if((free_block->payload.links.next != NULL) && (free_block->payload.links.prev != NULL)) //if it's not on either end
-    {
-    block_t *prev_block = free_block->payload.links.prev;
-    block_t *next_block = free_block->payload.links.next;
+static size_t max(size_t x, size_t y);
+static size_t min(size_t x, size_t y);
+static block_t *find_fit(arena_t *arena, size_t asize);
+static void *malloc_payload(size_t size);
+static void *heap_payload(size_t size);
+static void free_payload(void *bp);
+static void free_heap_payload(void *bp);
+static block_t *malloc_block(arena_t *arena, size_t asize, bool *fresh);
+static block_t *allocate(size_t asize, bool *fresh);
+static void *aligned_payload(size_t alignment, size_t size);
+static block_t *aligned_block(arena_t *arena, size_t asize, size_t alignment);
+static void free_block(arena_t *arena, block_t *block);
+static block_t *release_block(arena_t *arena, block_t *block, size_t size);
+static void settle_free(arena_t *arena, block_t *block);
+static size_t carve_blocks(arena_t *arena, block_t *block, size_t asize, size_t n, void **ptrs);
+static int compare_addresses(const void *a, const void *b);
+static bool region_grow(mm_region_t *region, size_t asize);
+static void region_release(mm_region_t *region, region_chunk_t *keep);
+static void consolidate(arena_t *arena);
+static size_t quick_bin(size_t size);
+static bool resize_block(arena_t *arena, block_t *block, size_t asize);
+static block_t *coalesce_block(arena_t *arena, block_t *block);
+static void split_block(arena_t *arena, block_t *block, size_t asize, size_t purged, size_t span);
 
-    prev_block->payload.links.next = next_block;  
+static size_t round_up(size_t size, size_t n);
+static size_t adjust_size(size_t size);
+static size_t size_class(size_t size);
+static word_t pack(size_t size, bool alloc, bool prev_alloc);
 
-    next_block->payload.links.prev = prev_block;  //these two lines adjust the next and prev to go past the block we will remove
-   
-    free_block = NULL;
-   
-    return;
-    }
+static size_t extract_size(word_t header);
+static size_t get_size(block_t *block);
 
+static bool extract_alloc(word_t header);
+static bool get_alloc(block_t *block);
 
-    return;
+static word_t read_header(block_t *block);
 
+static bool extract_mmapped(word_t header);
+static bool extract_sampled(word_t header);
 
+static bool extract_prev_alloc(word_t header);
+static bool get_prev_alloc(block_t *block);
 
-    // TODO: Implement remove block from the free list 
+static void write_header(block_t *block, size_t size, bool alloc, bool prev_alloc);
+static void write_footer(block_t *block, size_t size);
+static void write_prev_alloc(block_t *block, bool prev_alloc);
 
-}
+static bool get_fresh(block_t *block);
+static void write_fresh(block_t *block, bool fresh);
+static void zero_words(void *p, size_t size);
 
-/*
- * Finds a free block that of size at least asize
+static block_t *payload_to_header(void *bp);
+static void *header_to_payload(block_t *block);
+static word_t *header_to_footer(block_t *block);
+
+static block_t *find_next(block_t *block);
+static word_t *find_prev_footer(block_t *block);
+static block_t *find_prev(block_t *block);
+static void write_prev_mini(block_t *block, bool prev_mini);
+static bool extract_prev_mini(word_t header);
+
+static uint32_t block_link(arena_t *arena, block_t *block);
+static block_t *link_block(arena_t *arena, uint32_t link);
+
+static bool check_heap(arena_t *arena);
+static int check_arena(arena_t *arena);
+static int check_tree(block_t *node, block_t *parent, size_t *count);
+static void examine_heap(arena_t *arena);
+
+static block_t *extend_heap(arena_t *arena, size_t size);
+static block_t *grow_heap(arena_t *arena, size_t need);
+static block_t *top_free_block(arena_t *arena);
+static void trim_heap(arena_t *arena, block_t *block);
+static void insert_block(arena_t *arena, block_t *free_block);
+static size_t remove_block(arena_t *arena, block_t *free_block);
+static size_t free_meta_size(size_t size);
+
+static block_t **lane_head(arena_t *arena, size_t idx, int lane);
+static void lane_insert(arena_t *arena, size_t idx, int lane, block_t *prev, block_t *block);
+static void lane_remove(arena_t *arena, size_t idx, int lane, block_t *block);
+static block_t *lane_next(arena_t *arena, block_t *block, int lane);
+static int skip_levels(block_t *block);
+static void skip_insert(arena_t *arena, size_t idx, block_t *block);
+static block_t *list_fit(arena_t *arena, size_t idx, size_t asize, size_t *steps);
+
+static bool tree_is_red(block_t *node);
+static void tree_rotate(arena_t *arena, block_t *node, int dir);
+static void tree_insert(arena_t *arena, block_t *block);
+static void tree_remove(arena_t *arena, block_t *block);
+static void tree_replace(arena_t *arena, block_t *old, block_t *node);
+static block_t *tree_best_fit(arena_t *arena, size_t asize, size_t *steps);
+
+static void heap_lock(arena_t *arena);
+static void heap_unlock(arena_t *arena);
+
+static int arena_init_heap(arena_t *arena);
+static size_t arena_pages(arena_t *arena);
+static void *arena_sbrk(arena_t *arena, intptr_t incr);
+static unsigned char *arena_brk(arena_t *arena);
+static size_t arena_heap_size(arena_t *arena);
+static arena_t *arena_of(block_t *block);
+static arena_t *arena_self(void);
+
+static block_t *mmap_alloc(size_t size, size_t alignment);
+static unsigned char *mmap_base(block_t *block);
+static void mmap_free(block_t *block);
+static void *mmap_realloc(block_t *block, size_t size);
+
+static bool slab_owns(const void *p);
+static slab_run_t *slab_run_of(const void *p);
+static void *slab_alloc(arena_t *arena, size_t cls, bool *fresh);
+static void slab_free(slab_run_t *run, void *p);
+static void *small_alloc(size_t size, bool *fresh);
+static void small_free(void *p);
+static void slab_release(slab_run_t *run);
+
+static uint64_t coarse_ms(void);
+static void purge_tick(arena_t *arena);
+static void purge_arena(arena_t *arena);
+static void purge_tree(arena_t *arena, block_t *node);
+static void purge_block(arena_t *arena, block_t *block);
+static size_t purge_span(arena_t *arena, block_t *block, uintptr_t *lo);
+static size_t purged_share(size_t purged, size_t span, size_t part);
+static void keep_purged(arena_t *arena, block_t *block, size_t pages);
+
+static void *prof_malloc(size_t size) __attribute__((noinline));
+static int64_t prof_interval(void);
+static void prof_record(void *ptr, size_t size, void **pc, int depth);
+static void prof_forget(void *ptr);
+static void prof_mark(void *ptr, bool sampled);
+static void prof_reset(void);
+static void prof_lock(void);
+static void prof_unlock(void);
+static bool prof_write(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static uint64_t stats_clock(void);
+static void stats_latency(bool free_op, uint64_t start);
+static void stats_listed(arena_t *arena, size_t size, bool listed);
+static void stats_fit(arena_t *arena, size_t steps);
+static void stats_extend(arena_t *arena, size_t size);
+static void stats_coalesce(arena_t *arena);
+static void stats_split(arena_t *arena);
+static void stats_slab(arena_t *arena, size_t size, bool alloc);
+static void stats_purge(arena_t *arena);
+#ifdef MM_THREAD_SAFE
+static void stats_remote(arena_t *arena, size_t n);
+#endif
+#ifdef MM_STATS
+static void stats_add_arena(struct mm_stats *stats, arena_t *arena, size_t heap_bytes);
+static void stats_add_latency(struct mm_stats *stats, latency_t *lat);
+static size_t stats_huge_bytes(void);
+#endif
+
+static void remote_drain(arena_t *arena);
+#ifdef MM_THREAD_SAFE
+static void remote_push(arena_t *arena, void *p);
+static void remote_free(arena_t *arena, void *p, arena_t **locked);
+static tcache_t *tcache_self(void);
+static block_t *tcache_get(size_t asize);
+static bool tcache_put(block_t *block, size_t size);
+static void tcache_flush(tcache_t *tc, size_t bin, unsigned n);
+static void tcache_release(void *arg);
+static void *tcache_get_slot(size_t cls);
+static void tcache_put_slot(void *p, slab_run_t *run);
+static void tcache_flush_slots(tcache_t *tc, size_t cls, unsigned n);
+#endif
+
+/* 
+ * mm_init - Initialize the memory manager 
  */
-static block_t *find_fit(size_t asize)  //first fit
+int mm_init(void)
 {
-   /* 
-   
-   block_t * bp;   //make a block pointer
-    
-   // bp = find_next(heap_start);  //Point at the top of heap
-        bp = heap_start;
-    
+    prof_reset();       // Sampled blocks of the old heap are gone
+
+    /* Every slab run is released; the whole reservation is unused again */
+    if (slab_base != NULL) {
+        madvise(slab_base, slab_brk - slab_base, MADV_DONTNEED);
+        slab_brk = slab_base;
+        slab_free_runs = NULL;
+        slab_released = 0;
+    }
 
-    while(get_size(bp) != 0)   //While we are not at the end of the heap
-                            //Althought you know what, will it count the epilogue header as not null? Could that mess stuff up?
-    {
-        if((get_size(bp) >= asize) && (get_alloc(bp) == 0))      //If the size of the free block is greater than the size needed
-        {
-           
-            return bp;     //Is this all I need to do to put it in? Is this is? Seems too easy idk
+    if (arena_init_heap(&main_arena) < 0) {
+        return -1;
+    }
+
+#ifdef MM_THREAD_SAFE
+    /* Region arenas start over as well; their pages go back to the OS */
+    for (unsigned i = 1; i < MAX_ARENAS; i++) {
+        arena_t *arena = arenas[i];
+
+        if (arena == NULL) {
+            continue;
         }
-        bp = find_next(bp);
 
+        unsigned char *base = (unsigned char *) arena + round_up(sizeof(arena_t), dsize);
+
+        madvise(base, arena->brk - base, MADV_DONTNEED);
+        arena->brk = base;
+
+        if (arena_init_heap(arena) < 0) {
+            return -1;
+        }
     }
-*/
-    block_t *curr = free_list_head;
 
-    while(curr != NULL) //While we not at the end of the list
-    {   
-        if(get_size(curr) >= asize)
-        {
-            //remove_block(curr);  //I must have to do this, because we are gonna use it so it won't be free anymore
-            return curr;
+    /* Blocks cached by any thread belong to the old heap */
+    heap_generation++;
+#endif
+
+    return 0;
+}
+
+/*
+ * mm_mallopt - Set one of the allocator's tunables (MM_* in mm.h) to
+ *              value. Returns 0, or -1 if param is unknown or value out of
+ *              range. Meant to be called before mm_init, or at least
+ *              before other threads start allocating; the growth limits
+ *              take full effect, and the placement policy any effect, at
+ *              the next mm_init.
+ */
+int mm_mallopt(int param, size_t value)
+{
+    switch (param) {
+    case MM_MMAP_THRESHOLD:
+        mmap_threshold = value;
+        return 0;
+    case MM_TRIM_THRESHOLD:
+        trim_threshold = value;
+        return 0;
+    case MM_GROW_MIN:
+        if (value < min_block_size) {
+            return -1;
+        }
+        grow_min = round_up(value, dsize);
+        return 0;
+    case MM_GROW_MAX:
+        grow_max = value;
+        return 0;
+    case MM_PLACEMENT:
+        if (value > MM_PLACE_BEST_OF) {
+            return -1;
+        }
+        placement = (int) value;
+        return 0;
+    case MM_DECAY_MS:
+        decay_ms = value;
+        return 0;
+    case MM_BEST_OF:
+        if (value == 0) {
+            return -1;
         }
-        curr = curr->payload.links.next;
+        best_of = value;
+        return 0;
+    case MM_HUGEPAGES:
+        hugepages = value != 0;
+        return 0;
+    case MM_PROF_SAMPLE:
+        if (value > (size_t) INT64_MAX / 64) {
+            return -1;
+        }
+        prof_period = value;
+        prof_thread.countdown = 0;      // This thread now; others within prof_idle bytes
+        return 0;
+    default:
+        return -1;
     }
-   
-    
-    return NULL; // no fit found
 }
 
 /*
- * Coalesces current block with previous and next blocks if either or both are unallocated; otherwise the block is not modified.
- * Returns pointer to the coalesced block. After coalescing, the immediate contiguous previous and next blocks must be allocated.
+ * mm_checkheap - Check every arena's heap for consistency, dumping a
+ *                broken one to stderr. Returns 0 if all are consistent
+ *                and -1 otherwise.
  */
-static block_t *coalesce_block(block_t *block)
+int mm_checkheap(void)
 {
+    int result = 0;
 
-    block_t *prev_block = find_prev(block); 
-    block_t *next_block = find_next(block);
-    //block_t *old_block = block;
-    size_t combined_block = get_size(block);
+#ifdef MM_THREAD_SAFE
+    for (unsigned i = 1; i < MAX_ARENAS; i++) {
+        if (arenas[i] != NULL && check_arena(arenas[i]) < 0) {
+            result = -1;
+        }
+    }
+#endif
 
-   
-	  
-       if(get_alloc(next_block) == 0)        //If the next block is also free
+    if (check_arena(&main_arena) < 0) {
+        result = -1;
+    }
+
+    return result;
+}
+
+/*
+ * mm_usable_size - Returns how many bytes the block at ptr can hold, at
+ *                  least what was asked for when it was allocated; 0 for
+ *                  NULL.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    if (ptr == NULL) {
+        return 0;
+    }
+
+    if (slab_owns(ptr)) {
+        return slab_run_of(ptr)->slot_size;
+    }
+
+    block_t *block = payload_to_header(ptr);
+    word_t header = read_header(block);
+
+    if (extract_mmapped(header)) {
+        return mmap_base(block) + extract_size(header) - (unsigned char *) ptr;
+    }
+
+    return extract_size(header) - wsize;
+}
+
+/*
+ * mm_prefork / mm_postfork - Take every lock the allocator has before a
+ *                            fork and release them after it, in parent
+ *                            and child alike, so that the child never
+ *                            inherits a lock held by a thread that does
+ *                            not exist there. For pthread_atfork; no-ops
+ *                            unless built with MM_THREAD_SAFE.
+ */
+void mm_prefork(void)
+{
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_lock(&arenas_mutex);
+    for (unsigned i = 0; i < MAX_ARENAS; i++) {
+        if (arenas[i] != NULL) {
+            heap_lock(arenas[i]);       // Before slab_mutex, as slab_new_run takes them
+        }
+    }
+    pthread_mutex_lock(&slab_mutex);
+    pthread_mutex_lock(&prof_mutex);
+#ifdef MM_STATS
+    pthread_mutex_lock(&latency_mutex);
+#endif
+#endif
+}
+
+void mm_postfork(void)
+{
+#ifdef MM_THREAD_SAFE
+#ifdef MM_STATS
+    pthread_mutex_unlock(&latency_mutex);
+#endif
+    pthread_mutex_unlock(&prof_mutex);
+    pthread_mutex_unlock(&slab_mutex);
+    for (unsigned i = MAX_ARENAS; i-- > 0; ) {
+        if (arenas[i] != NULL) {
+            heap_unlock(arenas[i]);
+        }
+    }
+    pthread_mutex_unlock(&arenas_mutex);
+#endif
+}
+
+/*
+ * mm_prof_dump - Write the heap profiler's samples to path in the legacy
+ *                pprof heap format: the live and total sampled objects
+ *                and bytes per call stack, then the process's mappings,
+ *                for pprof to find the symbols. Returns 0, or -1 if the
+ *                file could not be written.
+ */
+int mm_prof_dump(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    prof_lock();
+
+    size_t live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+
+    for (size_t i = 0; prof_stacks != NULL && i < PROF_STACKS; i++) {
+        live_count += prof_stacks[i].live_count;
+        live_bytes += prof_stacks[i].live_bytes;
+        total_count += prof_stacks[i].total_count;
+        total_bytes += prof_stacks[i].total_bytes;
+    }
+
+    bool ok = prof_write(fd, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                         live_count, live_bytes, total_count, total_bytes, prof_period);
+
+    for (size_t i = 0; ok && prof_stacks != NULL && i < PROF_STACKS; i++) {
+        prof_stack_t *st = &prof_stacks[i];
+
+        if (st->hash == 0) {
+            continue;
+        }
+
+        ok = prof_write(fd, "%zu: %zu [%zu: %zu] @", st->live_count, st->live_bytes,
+                        st->total_count, st->total_bytes);
+        for (uint32_t d = 0; ok && d < st->depth; d++) {
+            ok = prof_write(fd, " %p", st->pc[d]);
+        }
+        ok = ok && prof_write(fd, "\n");
+    }
+
+    prof_unlock();
+
+    ok = ok && prof_write(fd, "\nMAPPED_LIBRARIES:\n");
+
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+
+    if (maps >= 0) {
+        char buf[4096];
+        ssize_t n;
+
+        while (ok && (n = read(maps, buf, sizeof(buf))) > 0) {
+            ok = write(fd, buf, n) == n;
+        }
+        close(maps);
+    }
+
+    if (close(fd) < 0) {
+        ok = false;
+    }
+
+    return ok ? 0 : -1;
+}
+
+/*
+ * check_arena - check_heap under the arena's lock, dumping the heap with
+ *               examine_heap if it is broken. Returns 0 or -1.
+ */
+static int check_arena(arena_t *arena)
+{
+    heap_lock(arena);
+
+    bool ok = check_heap(arena);
+    if (!ok) {
+        examine_heap(arena);
+    }
+
+    heap_unlock(arena);
+
+    return ok ? 0 : -1;
+}
+
+/*
+ * mm_stats - Fill in *stats with the allocator's counters, summed over all
+ *            arenas and threads. Heap counters cover the time since
+ *            mm_init, latency histograms the life of the process. Returns
+ *            -1, leaving *stats zeroed, unless built with MM_STATS.
+ */
+int mm_stats(struct mm_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+#ifdef MM_STATS
+#ifdef MM_THREAD_SAFE
+    for (unsigned i = 1; i < MAX_ARENAS; i++) {
+        arena_t *arena = arenas[i];
+
+        if (arena != NULL) {
+            heap_lock(arena);
+            stats_add_arena(stats, arena, arena_heap_size(arena));
+            heap_unlock(arena);
+        }
+    }
+#endif
+
+    heap_lock(&main_arena);
+    stats_add_arena(stats, &main_arena, arena_heap_size(&main_arena));
+    heap_unlock(&main_arena);
+
+    stats->mmap_bytes = __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+    stats->allocated_bytes += stats->mmap_bytes;
+    stats->huge_bytes = stats_huge_bytes();
+
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_lock(&latency_mutex);
+    stats_add_latency(stats, &latency_retired);
+    for (latency_t *lat = latency_threads; lat != NULL; lat = lat->next) {
+        stats_add_latency(stats, lat);
+    }
+    pthread_mutex_unlock(&latency_mutex);
+#else
+    stats_add_latency(stats, &thread_latency);
+#endif
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+#ifdef MM_STATS
+
+/*
+ * stats_add_arena - Add an arena's counters, and its heap of heap_bytes
+ *                   bytes, to *stats. Caller holds the arena lock.
+ */
+static void stats_add_arena(struct mm_stats *stats, arena_t *arena, size_t heap_bytes)
+{
+    arena_stats_t *as = &arena->stats;
+
+    stats->heap_bytes += heap_bytes;
+    stats->free_bytes += as->free_bytes;
+    stats->free_blocks += as->free_blocks;
+    stats->allocated_bytes += heap_bytes - as->free_bytes + as->slab_bytes;
+
+    stats->fit_searches += as->fit_searches;
+    stats->fit_steps += as->fit_steps;
+    if (as->fit_max_steps > stats->fit_max_steps) {
+        stats->fit_max_steps = as->fit_max_steps;
+    }
+
+    stats->extend_calls += as->extend_calls;
+    stats->extend_bytes += as->extend_bytes;
+    stats->coalesces += as->coalesces;
+    stats->splits += as->splits;
+
+    stats->purged_bytes += arena->purged_bytes;
+    stats->purges += as->purges;
+    stats->remote_frees += as->remote_frees;
+}
+
+/*
+ * stats_add_latency - Add one thread's histograms to *stats.
+ */
+static void stats_add_latency(struct mm_stats *stats, latency_t *lat)
+{
+    for (size_t i = 0; i < MM_STATS_BUCKETS; i++) {
+        stats->malloc_cycles[i] += __atomic_load_n(&lat->malloc_cycles[i], __ATOMIC_RELAXED);
+        stats->free_cycles[i] += __atomic_load_n(&lat->free_cycles[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * stats_huge_bytes - Returns how much of the heaps the kernel has backed
+ *                    with huge pages, transparent or hugetlbfs, adding up
+ *                    the AnonHugePages and *_Hugetlb lines that
+ *                    /proc/self/smaps gives for the mappings holding the
+ *                    main heap and the region arenas. 0 if it cannot be
+ *                    read.
+ */
+static size_t stats_huge_bytes(void)
+{
+    uintptr_t ranges[2][2] = {
+        { (uintptr_t) mem_heap_lo(), (uintptr_t) mem_heap_hi() + 1 },
+        { 0, 0 },
+    };
+
+#ifdef MM_THREAD_SAFE
+    unsigned char *base = __atomic_load_n(&regions_base, __ATOMIC_ACQUIRE);
+
+    if (base != NULL) {
+        ranges[1][0] = (uintptr_t) base;
+        ranges[1][1] = (uintptr_t) base + regions_span;
+    }
+#endif
+
+    int fd = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    char buf[4096];
+    size_t len = 0;
+    size_t kib = 0;
+    bool inside = false;        // Whether the mapping being read holds a heap
+    ssize_t n;
+
+    while ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+        len += n;
+        buf[len] = '\0';
+
+        char *line = buf;
+        char *eol;
+
+        while ((eol = strchr(line, '\n')) != NULL) {
+            *eol = '\0';
+
+            if ((*line >= '0' && *line <= '9') || (*line >= 'a' && *line <= 'f')) {
+                char *end;
+                uintptr_t lo = strtoull(line, &end, 16);
+                uintptr_t hi = strtoull(end + 1, NULL, 16);
+
+                inside = false;
+                for (int i = 0; i < 2; i++) {
+                    if (lo < ranges[i][1] && ranges[i][0] < hi) {
+                        inside = true;
+                    }
+                }
+            } else if (inside && (strncmp(line, "AnonHugePages:", 14) == 0 ||
+                                  strncmp(line, "Private_Hugetlb:", 16) == 0 ||
+                                  strncmp(line, "Shared_Hugetlb:", 15) == 0)) {
+                kib += strtoull(strchr(line, ':') + 1, NULL, 10);
+            }
+            line = eol + 1;
+        }
+
+        len = buf + len - line;
+        if (len == sizeof(buf) - 1) {
+            len = 0;                // A line longer than the buffer; none we want is
+        }
+        memmove(buf, line, len);
+    }
+
+    close(fd);
+
+    return kib * 1024;
+}
+
+#endif
+
+/*
+ * mm_footprint - Returns how many bytes of memory the allocator holds from
+ *                the system: the main heap, the region arenas' heaps (less
+ *                the pages purged from their free blocks), slab runs not
+ *                released, and mapped blocks. Only exact while no other
+ *                thread is allocating.
+ */
+size_t mm_footprint(void)
+{
+    size_t bytes = mem_heapsize();
+
+#ifdef MM_THREAD_SAFE
+    for (unsigned i = 1; i < MAX_ARENAS; i++) {
+        arena_t *arena = arenas[i];
+
+        if (arena != NULL) {
+            bytes += arena->brk - (unsigned char *) arena - arena->purged_bytes;
+        }
+    }
+#endif
+
+    if (slab_base != NULL) {
+        bytes += (slab_brk - slab_base) - slab_released;
+    }
+
+    bytes -= main_arena.purged_bytes;
+
+    return bytes + __atomic_load_n(&mmap_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * arena_pages - Back the arena's still empty heap with huge pages or
+ *               ordinary ones, as hugepages says. Returns the page size
+ *               it got. The main heap is memlib's, which can fall back
+ *               to hugetlbfs; region arenas only get transparent ones.
+ */
+static size_t arena_pages(arena_t *arena)
+{
+    size_t huge = mem_hugepagesize();
+
+#ifdef MM_THREAD_SAFE
+    if (arena != &main_arena) {
+        bool was_huge = arena->grain == huge;   // 0 for a new arena
+
+        if (hugepages == was_huge) {
+            return was_huge ? huge : mem_pagesize();
+        }
+
+        int advice = hugepages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE;
+
+        if (madvise(arena, arena->end - (unsigned char *) arena, advice) == 0) {
+            return hugepages ? huge : mem_pagesize();
+        }
+        return mem_pagesize();
+    }
+#else
+    (void) arena;
+#endif
+
+    int backing = mem_hugepages(hugepages);
+
+    return (backing == MEM_PAGES_THP || backing == MEM_PAGES_HUGETLB) ? huge : mem_pagesize();
+}
+
+/*
+ * arena_init_heap - Lay out an empty heap (prologue footer and epilogue
+ *                   header) at the arena's break and give it an initial
+ *                   free block of chunksize bytes.
+ */
+static int arena_init_heap(arena_t *arena)
+{
+    arena->grain = arena_pages(arena);
+
+    /* Create the initial empty heap */
+    word_t *start = (word_t *)(arena_sbrk(arena, 2*wsize));
+    if ((size_t)start == -1) {
+        printf("ERROR: mem_sbrk failed in mm_init, returning %p\n", start);
+        return -1;
+    }
+    
+    /* Prologue footer */
+    start[0] = pack(0, true, true);
+    /* Epilogue header */
+    start[1] = pack(0, true, true); 
+
+    /* Heap starts with first "block header", currently the epilogue header */
+    arena->heap_start = (block_t *) &(start[1]);
+
+    /* Start with every size class empty */
+    for (size_t i = 0; i < SEG_CLASSES; i++) {
+        arena->seg_lists[i] = NULL;
+        arena->seg_tails[i] = NULL;
+        arena->seg_rovers[i] = NULL;
+        for (int lane = 1; lane < SKIP_LEVELS; lane++) {
+            arena->seg_skips[i][lane - 1] = NULL;
+        }
+    }
+    arena->seg_bitmap = 0;
+    arena->placement = placement;
+    arena->tree_root = NULL;
+
+    for (size_t i = 0; i < QUICK_BINS; i++) {
+        arena->quick[i] = NULL;
+    }
+
+#ifdef MM_STATS
+    memset(&arena->stats, 0, sizeof(arena->stats));
+#endif
+
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        arena->slab_partial[i] = NULL;
+    }
+    arena->slab_spare = NULL;
+    arena->slab_dirty = NULL;
+
+    arena->purged_bytes = 0;
+    arena->purge_now = coarse_ms();
+    arena->purge_last = arena->purge_now;
+    arena->purge_ticks = 0;
+
+#ifdef MM_THREAD_SAFE
+    arena->remote = NULL;       // Whatever was pushed belonged to the old heap
+#endif
+
+    arena->grow_next = grow_min;
+
+    /* Extend the empty heap with a free block of chunksize bytes */
+    if (extend_heap(arena, chunksize) == NULL) {
+        printf("ERROR: extend_heap failed in mm_init, returning");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 
+ * mm_malloc - Allocate a block with at least size bytes of payload 
+ */
+void *mm_malloc(size_t size)
+{
+    uint64_t start = stats_clock();
+    void *bp;
+
+    if (__builtin_expect((prof_thread.countdown -= (int64_t) size) < 0, 0)) {
+        bp = prof_malloc(size);
+    } else {
+        bp = malloc_payload(size);
+    }
+
+    stats_latency(false, start);
+
+    return bp;
+}
+
+/*
+ * malloc_payload - mm_malloc without the latency accounting, for the
+ *                  other entry points to use.
+ */
+static void *malloc_payload(size_t size)
+{
+    bool fresh;         //Only mm_calloc cares that the memory was never used
+
+    if (size == 0 || size > max_request) // Ignore spurious request
+        return NULL;
+
+    if (size <= slab_max) {
+        void *slot = small_alloc(size, &fresh);
+        if (slot != NULL)       //Falls through to the heap if the slab reservation is used up
+            return slot;
+    }
+
+    return heap_payload(size);
+}
+
+/*
+ * heap_payload - malloc_payload without the slabs: a heap block, or a
+ *                mapping of its own for a big request. Either way the
+ *                block has a header. Caller checks size.
+ */
+static void *heap_payload(size_t size)
+{
+    size_t asize;
+    block_t *bp;
+    bool fresh;
+
+    if (size >= mmap_threshold && (bp = mmap_alloc(size, dsize)) != NULL)
+        return header_to_payload(bp);   //Falls through to the heap if the mapping fails
+
+    asize = adjust_size(size);
+
+    if ((bp = allocate(asize, &fresh)) == NULL)
+        return NULL;
+
+    return header_to_payload(bp);
+}
+
+/*
+ * allocate - Returns an allocated block of at least asize bytes, taken from
+ *            the calling thread's cache when possible and otherwise from
+ *            the heap under the heap lock. Sets *fresh as malloc_block does;
+ *            cached blocks are never fresh.
+ */
+static block_t *allocate(size_t asize, bool *fresh)
+{
+    block_t *bp;
+
+#ifdef MM_THREAD_SAFE
+    if (asize <= tcache_max && (bp = tcache_get(asize)) != NULL) {
+        *fresh = false;
+        return bp;
+    }
+#endif
+
+    arena_t *arena = arena_self();
+
+    heap_lock(arena);
+    remote_drain(arena);
+    bp = malloc_block(arena, asize, fresh);
+    heap_unlock(arena);
+
+    if (bp == NULL && arena != &main_arena) {
+        // This arena's region is used up; fall back to the main heap
+        arena = &main_arena;
+        heap_lock(arena);
+        remote_drain(arena);
+        bp = malloc_block(arena, asize, fresh);
+        heap_unlock(arena);
+    }
+
+    return bp;
+}
+
+/*
+ * malloc_block - Take a block of asize bytes off the quick list for its
+ *                size or the free lists (growing the heap if nothing fits)
+ *                and mark it allocated. *fresh tells whether the block
+ *                still holds the zero fill of new heap memory, for
+ *                mm_calloc. Caller holds the heap lock.
+ */
+static block_t *malloc_block(arena_t *arena, size_t asize, bool *fresh)
+{
+  block_t *bp;
+
+  if (asize <= quick_max && (bp = arena->quick[quick_bin(asize)]) != NULL)
+  {
+      arena->quick[quick_bin(asize)] = bp->payload.chain;     //Still marked allocated, so nothing else to do
+      *fresh = false;
+      return bp;
+  }
+
+  if((bp = find_fit(arena, asize)) == NULL)  //If the heap has nothing free
+  {
+      consolidate(arena);       //Merging the quick lists may make room
+
+      if ((bp = find_fit(arena, asize)) == NULL)
       {
-         
+          block_t *top = top_free_block(arena);      //A free block at the top already covers part of it
+          bp = grow_heap(arena, asize - (top != NULL ? get_size(top) : 0));
+      }
+  }
+
+  if(bp == NULL)
+  {
+      return NULL;
+  }
+
+  size_t span = purge_span(arena, bp, NULL);
+  size_t purged = remove_block(arena, bp);     //Take it off its size class list before the size changes
+
+  bp->header |= alloc_mask;     //Only flip the alloc bit so the fresh bit survives the split
+  write_prev_alloc(find_next(bp), true);
+                                
+  split_block(arena, bp, asize, purged, span);
+
+  *fresh = get_fresh(bp);
+  write_fresh(bp, false);
+
+  return bp;
+}
+
+
+/* 
+ * mm_free - Free a block 
+ */
+void mm_free(void *bp)
+{
+    uint64_t start = stats_clock();
+
+    free_payload(bp);
+
+    stats_latency(true, start);
+}
+
+/*
+ * mm_free_sized - Free a block allocated with size bytes, as C++ sized
+ *                 delete and allocators know. Only requests of at most
+ *                 slab_max bytes can be slab slots, so larger ones go
+ *                 straight to the heap path; the header is still read for
+ *                 its flags.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+    uint64_t start = stats_clock();
+
+    if (size <= slab_max) {
+        free_payload(bp);
+    } else {
+        free_heap_payload(bp);
+    }
+
+    stats_latency(true, start);
+}
+
+/*
+ * mm_free_aligned_sized - Free a block allocated with size bytes aligned to
+ *                         alignment. Blocks aligned beyond what the heap
+ *                         gives anyway are never slab slots.
+ */
+void mm_free_aligned_sized(void *bp, size_t alignment, size_t size)
+{
+    if (alignment <= dsize) {
+        mm_free_sized(bp, size);
+        return;
+    }
+
+    uint64_t start = stats_clock();
+
+    free_heap_payload(bp);
+
+    stats_latency(true, start);
+}
+
+/*
+ * free_payload - mm_free without the latency accounting.
+ */
+static void free_payload(void *bp)
+{
+    if (bp != NULL && slab_owns(bp)) {
+        small_free(bp);
+        return;
+    }
+
+    free_heap_payload(bp);
+}
+
+/*
+ * free_heap_payload - free_payload for a pointer known not to be a slab
+ *                     slot: a heap block or a mapped one.
+ */
+static void free_heap_payload(void *bp)
+{
+    if (bp == NULL)
+        return;
+
+    block_t *block = payload_to_header(bp);
+    word_t header = read_header(block);
+
+    if (extract_alloc(header) == 0)     //Just leave if what they want to free is already free
+        return;
+
+    if (extract_sampled(header)) {      //The heap profiler recorded it
+        prof_forget(bp);
+    }
+
+    if (extract_mmapped(header)) {      //Big blocks have their own mapping
+        mmap_free(block);
+        return;
+    }
+
+#ifdef MM_THREAD_SAFE
+    if (tcache_put(block, extract_size(header)))    //Most small frees stop at the thread cache
+        return;
+#endif
+
+    arena_t *arena = arena_of(block);     //Blocks always go back to the arena they came from
+
+#ifdef MM_THREAD_SAFE
+    if (arena != thread_arena) {          //Another arena's block: free it or leave it to its threads
+        arena_t *locked = NULL;
+
+        remote_free(arena, bp, &locked);
+        if (locked != NULL) {
+            heap_unlock(locked);
+        }
+        return;
+    }
+#endif
+
+    heap_lock(arena);
+    free_block(arena, block);
+    heap_unlock(arena);
+}
+
+/*
+ * free_block - Return an allocated block to its arena: small blocks go on
+ *              their quick list as they are, others are merged with free
+ *              neighbours and put on the free lists. Caller holds the heap
+ *              lock.
+ */
+static void free_block(arena_t *arena, block_t *block)
+{
+    size_t bpSize = get_size(block);          //Get the size of the current block
+
+    if (bpSize <= quick_max) {
+        size_t bin = quick_bin(bpSize);
+
+        block->payload.chain = arena->quick[bin];
+        arena->quick[bin] = block;
+        return;
+    }
+
+    settle_free(arena, release_block(arena, block, bpSize));
+}
+
+/*
+ * release_block - Mark the size bytes starting at an allocated block free
+ *                 (normally just that block, but mm_free_batch passes a
+ *                 run of adjacent ones) and merge them with their free
+ *                 neighbours onto the free lists. Returns the merged
+ *                 block. Caller holds the heap lock.
+ */
+static block_t *release_block(arena_t *arena, block_t *block, size_t size)
+{
+    write_header(block, size, 0, get_prev_alloc(block));  //So i just keep the size and all the same, just change the alloc bit from true to false.
+    write_footer(block, size);
+
+    return coalesce_block(arena, block);      //Merges with free neighbours and puts the result on the right list
+}
+
+/*
+ * settle_free - Follow up on a free that produced the free block: count it
+ *               towards the next purge, and once it is quick_consolidate
+ *               bytes or more, merge what the quick lists hold and give a
+ *               big enough free top of the heap back to the system.
+ *               Caller holds the heap lock.
+ */
+static void settle_free(arena_t *arena, block_t *block)
+{
+    purge_tick(arena);
+
+    if (get_size(block) < quick_consolidate) {
+        return;
+    }
+
+    consolidate(arena);     //Plenty of free memory around; merge what the quick lists hold
+
+    block_t *top = top_free_block(arena);
+
+    if (top != NULL && get_size(top) >= trim_threshold + arena->grow_next) {
+        trim_heap(arena, top);       //A big free block at the top of the heap goes back to the system
+    }
+}
+
+/*
+ * consolidate - Free every block waiting on the arena's quick lists for
+ *               real, merging each with its free neighbours. Caller holds
+ *               the heap lock.
+ */
+static void consolidate(arena_t *arena)
+{
+    for (size_t bin = 0; bin < QUICK_BINS; bin++) {
+        block_t *block = arena->quick[bin];
+
+        arena->quick[bin] = NULL;
+
+        while (block != NULL) {
+            block_t *next = block->payload.chain;
+
+            release_block(arena, block, get_size(block));
+            block = next;
+        }
+    }
+}
+
+/*
+ * quick_bin - Returns the quick list index for a block of size bytes
+ *             (min_block_size <= size <= quick_max).
+ */
+static size_t quick_bin(size_t size)
+{
+    return (size - min_block_size) / dsize;
+}
+
+/*
+ * mm_realloc - Resize the block at ptr to hold at least size bytes.
+ *
+ * Works in place whenever the heap allows: shrinking splits off the tail,
+ * growing first absorbs a free successor, and a block that ends the heap
+ * (possibly followed only by a free block) grows by extending the heap.
+ * Only when none of that applies is the payload copied to a new block.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return malloc_payload(size);
+    }
+    if (size == 0) {
+        free_payload(ptr);
+        return NULL;
+    }
+    if (size > max_request) {
+        return NULL;
+    }
+
+    if (slab_owns(ptr)) {
+        size_t slot_size = slab_run_of(ptr)->slot_size;
+
+        if (size <= slot_size) {        // Still fits its slot
+            return ptr;
+        }
+
+        void *newptr = malloc_payload(size);
+        if (newptr == NULL) {
+            return NULL;
+        }
+
+        memcpy(newptr, ptr, slot_size);
+        small_free(ptr);
+
+        return newptr;
+    }
+
+    block_t *block = payload_to_header(ptr);
+
+    if (extract_sampled(read_header(block))) {     // Resizing may move or rewrite it
+        prof_forget(ptr);
+    }
+
+    if (extract_mmapped(read_header(block))) {
+        return mmap_realloc(block, size);
+    }
+
+    size_t asize = adjust_size(size);
+    size_t bsize = extract_size(read_header(block));
+
+    arena_t *arena = arena_of(block);
+
+    heap_lock(arena);
+    bool resized = resize_block(arena, block, asize);
+    heap_unlock(arena);
+
+    if (resized) {
+        return ptr;
+    }
+
+    void *newptr = malloc_payload(size);
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    memcpy(newptr, ptr, bsize - wsize);
+    free_payload(ptr);
+
+    return newptr;
+}
+
+/*
+ * resize_block - Try to make an allocated block exactly asize bytes (or
+ *                asize plus a sliver too small to split off) without moving
+ *                it. Returns false if the neighbours leave no room. Caller
+ *                holds the heap lock.
+ */
+static bool resize_block(arena_t *arena, block_t *block, size_t asize)
+{
+    size_t bsize = get_size(block);
+
+    if (asize <= bsize) {       // Shrink (or keep) in place
+        split_block(arena, block, asize, 0, 0);
+        return true;
+    }
+
+    block_t *next = find_next(block);
+    size_t avail = bsize;
+
+    if (!get_alloc(next)) {
+        avail += get_size(next);
+    }
+
+    // Grow into the heap tail: extend_heap merges the new space with any
+    // free block after us, leaving one free block that reaches the epilogue
+    if (avail < asize && (get_size(next) == 0 ||
+                          (!get_alloc(next) && get_size(find_next(next)) == 0))) {
+        if (grow_heap(arena, asize - avail) != NULL) {
+            next = find_next(block);
+            avail = bsize + get_size(next);
+        }
+    }
+
+    if (avail < asize) {
+        return false;
+    }
+
+    // Absorb the free successor
+    size_t span = purge_span(arena, next, NULL);
+    size_t purged = remove_block(arena, next);
+
+    write_header(block, avail, 1, get_prev_alloc(block));
+    write_prev_alloc(find_next(block), true);
+    split_block(arena, block, asize, purged, span);
+
+    return true;
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes.
+ *
+ * Blocks carved from never-used heap memory are already zero except for
+ * the words the free list wrote into them (links and footer), so only
+ * those are cleared; recycled blocks are cleared in full. Mapped blocks
+ * need no clearing at all.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        return NULL;
+    }
+
+    if (bytes == 0 || bytes > max_request) {
+        return NULL;
+    }
+
+    if (__builtin_expect((prof_thread.countdown -= (int64_t) bytes) < 0, 0)) {
+        void *ptr = prof_malloc(bytes);
+
+        if (ptr != NULL) {
+            memset(ptr, 0, bytes);
+        }
+        return ptr;
+    }
+
+    bool fresh;
+
+    if (bytes <= slab_max) {
+        void *slot = small_alloc(bytes, &fresh);
+
+        if (slot != NULL) {
+            if (!fresh) {
+                zero_words(slot, bytes);
+            }
+            return slot;
+        }
+    }
+
+    block_t *block;
+
+    if (bytes >= mmap_threshold && (block = mmap_alloc(bytes, dsize)) != NULL) {
+        return header_to_payload(block);        // New mappings are zero filled
+    }
+
+    block = allocate(adjust_size(bytes), &fresh);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    void *ptr = header_to_payload(block);
+
+    if (fresh) {
+        size_t bsize = extract_size(read_header(block));
+
+        // Links or tree node from when this was the start of a free block
+        size_t meta = free_meta_size(tree_min) - offsetof(block_t, payload);
+
+        zero_words(&block->payload, (meta < bsize - wsize) ? meta : bsize - wsize);
+        *(word_t *) ((unsigned char *) block + bsize - wsize) = 0;  // old footer
+    } else {
+        zero_words(ptr, bytes);
+    }
+
+    return ptr;
+}
+
+/*
+ * mm_memalign - Allocate a block with at least size bytes of payload at an
+ *               address that is a multiple of alignment, a power of two.
+ *               Returns NULL if alignment is not one or memory ran out.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    return aligned_payload(alignment, size);
+}
+
+/*
+ * mm_posix_memalign - posix_memalign: store an aligned block of size bytes
+ *                     in *memptr. Returns 0, EINVAL if alignment is not a
+ *                     power of two multiple of sizeof(void *), or ENOMEM.
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+
+    void *bp = aligned_payload(alignment, size);
+    if (bp == NULL) {
+        return ENOMEM;
+    }
+
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc. Any size is accepted, not only
+ *                    multiples of alignment.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * aligned_payload - Allocate size bytes aligned to alignment (a power of
+ *                   two). Alignments the heap already gives need nothing
+ *                   special; larger ones are cut out of a heap block with
+ *                   room to spare, or mapped when that block would be
+ *                   mmap-sized.
+ */
+static void *aligned_payload(size_t alignment, size_t size)
+{
+    if (alignment <= dsize) {
+        return malloc_payload(size);
+    }
+
+    if (size == 0 || size > max_request || alignment > max_request - size) {
+        return NULL;
+    }
+
+    size_t asize = adjust_size(size);
+    block_t *bp;
+
+    if (asize + alignment >= mmap_threshold && (bp = mmap_alloc(size, alignment)) != NULL) {
+        return header_to_payload(bp);
+    }
+
+    arena_t *arena = arena_self();
+
+    heap_lock(arena);
+    bp = aligned_block(arena, asize, alignment);
+    heap_unlock(arena);
+
+    if (bp == NULL && arena != &main_arena) {
+        arena = &main_arena;
+        heap_lock(arena);
+        bp = aligned_block(arena, asize, alignment);
+        heap_unlock(arena);
+    }
+
+    return (bp != NULL) ? header_to_payload(bp) : NULL;
+}
+
+/*
+ * aligned_block - Returns an allocated block of asize bytes whose payload
+ *                 is aligned to alignment. A block big enough to hold an
+ *                 aligned one anywhere inside is allocated, then the slack
+ *                 in front of the aligned payload is freed as a block of
+ *                 its own and the slack behind it is split off, so both go
+ *                 back on the free lists. Caller holds the heap lock.
+ */
+static block_t *aligned_block(arena_t *arena, size_t asize, size_t alignment)
+{
+    bool fresh;
+    block_t *block = malloc_block(arena, asize + alignment - dsize, &fresh);
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    // Payloads are dsize aligned, so lead is too: either 0 or a free block
+    uintptr_t payload = (uintptr_t) header_to_payload(block);
+    size_t lead = round_up(payload, alignment) - payload;
+
+    if (lead != 0) {
+        block_t *aligned = (block_t *) ((unsigned char *) block + lead);
+
+        write_header(aligned, get_size(block) - lead, 1, true);
+        release_block(arena, block, lead);     // Clears aligned's prev_alloc bit
+        block = aligned;
+    }
+
+    split_block(arena, block, asize, 0, 0);
+
+    return block;
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of at least size bytes each, storing
+ *                   their payload pointers in ptrs[0..n-1]. Returns how
+ *                   many it allocated, which is less than n only if memory
+ *                   ran out; the rest of ptrs is left alone.
+ *
+ * Heap-sized requests are carved back to back out of as few free blocks
+ * as possible, one fit search, list removal and split per free block
+ * rather than per allocation. Small and mapped sizes already have cheap
+ * paths of their own and are simply allocated one at a time.
+ */
+size_t mm_malloc_batch(size_t n, size_t size, void **ptrs)
+{
+    size_t count = 0;
+
+    if (n == 0 || size == 0 || size > max_request) {
+        return 0;
+    }
+
+    // The batch counts down to the next heap profile sample as n calls of
+    // mm_malloc would; if it gets there, the first block is the sample
+    size_t bytes = (n <= INT64_MAX / size) ? n * size : INT64_MAX;
+
+    if (__builtin_expect((prof_thread.countdown -= (int64_t) bytes) < 0, 0)) {
+        if ((ptrs[0] = prof_malloc(size)) == NULL) {
+            return 0;
+        }
+        count = 1;
+    }
+
+    if (size > slab_max && size < mmap_threshold) {
+        size_t asize = adjust_size(size);
+        arena_t *arena = arena_self();
+
+        heap_lock(arena);
+
+        while (count < n && asize <= quick_max && arena->quick[quick_bin(asize)] != NULL) {
+            block_t *bp = arena->quick[quick_bin(asize)];
+
+            arena->quick[quick_bin(asize)] = bp->payload.chain;
+            ptrs[count++] = header_to_payload(bp);
+        }
+
+        while (count < n) {
+            size_t want = n - count;
+
+            if (want > max_request / asize) {
+                want = max_request / asize;
+            }
+
+            // Room for the rest of the batch at once, else room for one
+            block_t *bp = find_fit(arena, want * asize);
+
+            if (bp == NULL && (bp = find_fit(arena, asize)) == NULL) {
+                consolidate(arena);
+
+                if ((bp = find_fit(arena, asize)) == NULL) {
+                    block_t *top = top_free_block(arena);
+
+                    bp = grow_heap(arena, want * asize - (top != NULL ? get_size(top) : 0));
+                }
+            }
+
+            if (bp == NULL) {
+                break;      // Out of memory here; the loop below tries the other routes
+            }
+
+            count += carve_blocks(arena, bp, asize, n - count, ptrs + count);
+        }
+
+        heap_unlock(arena);
+    }
+
+    for (void *p; count < n && (p = malloc_payload(size)) != NULL; ) {
+        ptrs[count++] = p;
+    }
+
+    return count;
+}
+
+/*
+ * carve_blocks - Cut up to n allocated blocks of asize bytes from the
+ *                front of the free block, storing their payloads in ptrs,
+ *                and return the rest to the free lists (or hand it to the
+ *                last block if it is too small to stand alone). Returns
+ *                how many blocks were cut. Caller holds the heap lock.
+ */
+static size_t carve_blocks(arena_t *arena, block_t *block, size_t asize, size_t n, void **ptrs)
+{
+    size_t bsize = get_size(block);
+    bool fresh = get_fresh(block);
+    bool prev_alloc = get_prev_alloc(block);
+    size_t count = bsize / asize;
+
+    if (count > n) {
+        count = n;
+    }
+
+    size_t span = purge_span(arena, block, NULL);
+    size_t purged = remove_block(arena, block);
+    size_t rest = bsize - count * asize;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t this_size = (i + 1 == count && rest < min_block_size) ? asize + rest : asize;
+
+        write_header(block, this_size, 1, prev_alloc);
+        ptrs[i] = header_to_payload(block);
+
+        prev_alloc = true;
+        block = find_next(block);
+    }
+
+    if (rest >= min_block_size) {
+        stats_split(arena);
+
+        write_header(block, rest, 0, 1);
+        write_footer(block, rest);
+        write_fresh(block, fresh);
+
+        size_t share = purged_share(purged, span, purge_span(arena, block, NULL));
+
+        keep_purged(arena, coalesce_block(arena, block), share);    // Files the rest under its own size class
+    } else {
+        write_prev_alloc(block, true);
+    }
+
+    return count;
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs, any of which may be NULL.
+ *                 Sorts ptrs by address in the process.
+ *
+ * Sorting puts blocks that lie back to back in the heap next to each
+ * other, and each such run is marked free and merged with its neighbours
+ * as one block, under one lock acquisition per arena. Blocks standing on
+ * their own take the usual mm_free route.
+ */
+void mm_free_batch(size_t n, void **ptrs)
+{
+    qsort(ptrs, n, sizeof(*ptrs), compare_addresses);
+
+    size_t i = 0;
+
+    while (i < n) {
+        void *bp = ptrs[i++];
+
+        if (bp == NULL || slab_owns(bp)) {
+            free_payload(bp);
+            continue;
+        }
+
+        block_t *block = payload_to_header(bp);
+        word_t header = read_header(block);
+
+        if (extract_alloc(header) == 0 || extract_mmapped(header) || extract_sampled(header)) {
+            free_payload(bp);
+            continue;
+        }
+
+        arena_t *arena = arena_of(block);
+
+        heap_lock(arena);
+
+        for (;;) {
+            size_t run = get_size(block);
+            block_t *next = find_next(block);
+
+            // Stretch the run over the following pointers while they are
+            // the very next block (repeats of a pointer are skipped)
+            while (i < n && (ptrs[i] == bp ||
+                             (payload_to_header(ptrs[i]) == next && !extract_sampled(next->header)))) {
+                if (ptrs[i] != bp) {
+                    bp = ptrs[i];
+                    run += get_size(next);
+                    next = find_next(next);
+                }
+                i++;
+            }
+
+            if (run == get_size(block)) {
+                free_block(arena, block);
+            } else {
+                settle_free(arena, release_block(arena, block, run));
+            }
+
+            // Keep the lock while the next pointer is another free of this arena
+            if (i == n || slab_owns(ptrs[i]) ||
+                (block = payload_to_header(bp = ptrs[i]), arena_of(block) != arena) ||
+                extract_alloc(header = read_header(block)) == 0 || extract_mmapped(header) ||
+                extract_sampled(header)) {
+                break;
+            }
+            i++;
+        }
+
+        heap_unlock(arena);
+    }
+}
+
+/*
+ * compare_addresses - qsort comparator ordering pointers by address.
+ */
+static int compare_addresses(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(void * const *) a;
+    uintptr_t y = (uintptr_t) *(void * const *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * mm_region_create - Returns a new, empty region whose first chunk will
+ *                    hold chunk_size bytes (0 for the default), or NULL.
+ *                    A region is used by one thread at a time.
+ */
+mm_region_t *mm_region_create(size_t chunk_size)
+{
+    mm_region_t *region = malloc_payload(sizeof(mm_region_t));
+
+    if (region == NULL) {
+        return NULL;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = region_chunk_min;
+    }
+
+    region->chunks = NULL;
+    region->top = NULL;
+    region->end = NULL;
+    region->chunk_size = min(chunk_size, region_chunk_max);
+
+    return region;
+}
+
+/*
+ * mm_region_alloc - Allocate size bytes, 16-byte aligned, from region.
+ *                   They stay until the region is reset, rolled back past
+ *                   them or destroyed. Returns NULL if size is 0 or memory
+ *                   ran out.
+ */
+void *mm_region_alloc(mm_region_t *region, size_t size)
+{
+    if (size == 0 || size > max_request) {
+        return NULL;
+    }
+
+    size_t asize = round_up(size, dsize);
+
+    if (asize > (size_t) (region->end - region->top) && !region_grow(region, asize)) {
+        return NULL;
+    }
+
+    void *p = region->top;
+
+    region->top += asize;
+    return p;
+}
+
+/*
+ * mm_region_mark - Returns where region's allocation has got to, for
+ *                  mm_region_rollback.
+ */
+mm_region_mark_t mm_region_mark(mm_region_t *region)
+{
+    mm_region_mark_t mark = { region->chunks, region->top };
+
+    return mark;
+}
+
+/*
+ * mm_region_rollback - Free everything allocated from region since mark,
+ *                      which must have been taken since the last reset
+ *                      and not be older than a mark already rolled back
+ *                      to. Chunks taken since then go back to the heap.
+ */
+void mm_region_rollback(mm_region_t *region, mm_region_mark_t mark)
+{
+    region_release(region, mark.chunk);
+
+    if (mark.chunk != NULL) {
+        region->top = mark.top;
+    }
+}
+
+/*
+ * mm_region_reset - Free everything allocated from region. Only the
+ *                   newest chunk, the largest, is kept for reuse; the
+ *                   others go back to the heap.
+ */
+void mm_region_reset(mm_region_t *region)
+{
+    region_chunk_t *newest = region->chunks;
+
+    if (newest == NULL) {
+        return;
+    }
+
+    region->chunks = newest->next;
+    region_release(region, NULL);
+
+    newest->next = NULL;
+    region->chunks = newest;
+    region->top = (unsigned char *) newest + round_up(sizeof(region_chunk_t), dsize);
+    region->end = (unsigned char *) newest + newest->size;
+}
+
+/*
+ * mm_region_destroy - Free region and everything allocated from it.
+ */
+void mm_region_destroy(mm_region_t *region)
+{
+    if (region == NULL) {
+        return;
+    }
+
+    region_release(region, NULL);
+    free_payload(region);
+}
+
+/*
+ * region_grow - Start a new chunk in region with room for asize bytes.
+ *               Whatever the old one had left is not used again.
+ */
+static bool region_grow(mm_region_t *region, size_t asize)
+{
+    size_t offset = round_up(sizeof(region_chunk_t), dsize);
+    size_t size = max(region->chunk_size, asize + offset);
+    region_chunk_t *chunk;
+
+    if (asize > max_request - offset || (chunk = heap_payload(size)) == NULL) {
+        return false;
+    }
+
+    chunk->next = region->chunks;
+    chunk->size = size;
+    region->chunks = chunk;
+    region->top = (unsigned char *) chunk + offset;
+    region->end = (unsigned char *) chunk + size;
+    region->chunk_size = min(2 * region->chunk_size, region_chunk_max);
+
+    return true;
+}
+
+/*
+ * region_release - Free region's chunks newer than keep (all of them for
+ *                  NULL) and make keep the chunk allocation bumps through.
+ *                  The caller sets top when keep is not NULL.
+ */
+static void region_release(mm_region_t *region, region_chunk_t *keep)
+{
+    while (region->chunks != keep) {
+        region_chunk_t *chunk = region->chunks;
+
+        region->chunks = chunk->next;
+        free_heap_payload(chunk);
+    }
+
+    if (keep == NULL) {
+        region->top = NULL;
+        region->end = NULL;
+    } else {
+        region->end = (unsigned char *) keep + keep->size;
+    }
+}
+
+/*
+ * insert_block - Put a free block on the list for its size class where
+ *                the placement policy wants it (head, tail or address
+ *                order) and mark the class non-empty in seg_bitmap. Blocks
+ *                of tree_min bytes or more go into the tree instead.
+ */
+static void insert_block(arena_t *arena, block_t *free_block)
+{
+    stats_listed(arena, get_size(free_block), true);
+
+    if (get_size(free_block) >= tree_min) {
+        free_block->payload.node.purged = 0;
+        free_block->payload.node.freed_at = arena->purge_now;
+        tree_insert(arena, free_block);
+        return;
+    }
+
+    size_t idx = size_class(get_size(free_block));
+
+    switch (arena->placement) {
+    case MM_PLACE_FIFO:
+        lane_insert(arena, idx, 0, arena->seg_tails[idx], free_block);
+        break;
+    case MM_PLACE_ADDRESS:
+        skip_insert(arena, idx, free_block);
+        break;
+    default:
+        lane_insert(arena, idx, 0, NULL, free_block);
+        break;
+    }
+
+    arena->seg_bitmap |= (uint64_t) 1 << idx;
+}
+
+/*
+ * remove_block - Unlink a free block from its size class list (or the
+ *                tree), clearing the class bit in seg_bitmap when the list
+ *                becomes empty. Must be called while the header still
+ *                holds the size the block was inserted with. Returns how
+ *                many of its pages were purged; they are no longer
+ *                counted, and a caller that keeps part of the block free
+ *                hands them on with purged_share and keep_purged.
+ */
+static size_t remove_block(arena_t *arena, block_t *free_block) 
+{
+    stats_listed(arena, get_size(free_block), false);
+
+    if (get_size(free_block) >= tree_min) {
+        size_t purged = free_block->payload.node.purged;
+
+        // Its purged pages fault back in as the block is reused
+        arena->purged_bytes -= purged * mem_pagesize();
+        tree_remove(arena, free_block);
+        return purged;
+    }
+
+    size_t idx = size_class(get_size(free_block));
+    int lanes = (arena->placement == MM_PLACE_ADDRESS) ? skip_levels(free_block) : 1;
+
+    if (arena->seg_rovers[idx] == free_block) {
+        arena->seg_rovers[idx] = lane_next(arena, free_block, 0);
+    }
+
+    for (int lane = 0; lane < lanes; lane++) {
+        lane_remove(arena, idx, lane, free_block);
+    }
+
+    if (arena->seg_lists[idx] == NULL) {
+        arena->seg_bitmap &= ~((uint64_t) 1 << idx);
+    }
+
+    return 0;
+}
+
+/*
+ * lane_head - Returns where the head of lane `lane` of list idx is kept:
+ *             lane 0 is the list itself.
+ */
+static block_t **lane_head(arena_t *arena, size_t idx, int lane)
+{
+    return (lane == 0) ? &arena->seg_lists[idx] : &arena->seg_skips[idx][lane - 1];
+}
+
+/*
+ * lane_next - Returns the block after block on a lane, or NULL.
+ */
+static block_t *lane_next(arena_t *arena, block_t *block, int lane)
+{
+    return link_block(arena, block->payload.lanes[lane].next);
+}
+
+/*
+ * lane_insert - Link block into a lane of list idx right after prev, or
+ *               at the head if prev is NULL.
+ */
+static void lane_insert(arena_t *arena, size_t idx, int lane, block_t *prev, block_t *block)
+{
+    block_t **head = lane_head(arena, idx, lane);
+    block_t *next = (prev != NULL) ? lane_next(arena, prev, lane) : *head;
+
+    block->payload.lanes[lane].prev = block_link(arena, prev);
+    block->payload.lanes[lane].next = block_link(arena, next);
+
+    if (next != NULL) {
+        next->payload.lanes[lane].prev = block_link(arena, block);
+    } else if (lane == 0) {
+        arena->seg_tails[idx] = block;
+    }
+
+    if (prev != NULL) {
+        prev->payload.lanes[lane].next = block_link(arena, block);
+    } else {
+        *head = block;
+    }
+}
+
+/*
+ * lane_remove - Unlink block from a lane of list idx.
+ */
+static void lane_remove(arena_t *arena, size_t idx, int lane, block_t *block)
+{
+    block_t *prev = link_block(arena, block->payload.lanes[lane].prev);
+    block_t *next = link_block(arena, block->payload.lanes[lane].next);
+
+    if (next != NULL) {
+        next->payload.lanes[lane].prev = block->payload.lanes[lane].prev;
+    } else if (lane == 0) {
+        arena->seg_tails[idx] = prev;
+    }
+
+    if (prev != NULL) {
+        prev->payload.lanes[lane].next = block->payload.lanes[lane].next;
+    } else {
+        *lane_head(arena, idx, lane) = next;
+    }
+}
+
+/*
+ * skip_levels - Returns how many lanes of the skip list a free block is
+ *               on: one, plus one for each pair of trailing zero bits of
+ *               a hash of its address (so each lane up holds about a
+ *               quarter of the blocks), but no more than fit between its
+ *               header and footer.
+ */
+static int skip_levels(block_t *block)
+{
+    size_t size = get_size(block);
+    size_t room = (size > min_block_size) ? (size - dsize) / sizeof(block->payload.lanes[0]) : 1;
+    uint32_t hash = (uint32_t) ((((uintptr_t) block >> 4) * 0x9E3779B97F4A7C15ull) >> 32);
+    size_t levels = 1 + __builtin_ctz(hash | (1u << 31)) / 2;
+
+    if (levels > room) {
+        levels = room;
+    }
+    return (levels < SKIP_LEVELS) ? (int) levels : SKIP_LEVELS;
+}
+
+/*
+ * skip_insert - Link a free block into list idx in address order, finding
+ *               its place on each lane by dropping down from the sparsest.
+ */
+static void skip_insert(arena_t *arena, size_t idx, block_t *block)
+{
+    block_t *preds[SKIP_LEVELS];
+    block_t *prev = NULL;       // Last block below `block` found so far; on every lower lane too
+
+    for (int lane = SKIP_LEVELS - 1; lane >= 0; lane--) {
+        block_t *curr = (prev != NULL) ? lane_next(arena, prev, lane) : *lane_head(arena, idx, lane);
+
+        while (curr != NULL && curr < block) {
+            prev = curr;
+            curr = lane_next(arena, curr, lane);
+        }
+        preds[lane] = prev;
+    }
+
+    int levels = skip_levels(block);
+
+    for (int lane = 0; lane < levels; lane++) {
+        lane_insert(arena, idx, lane, preds[lane], block);
+    }
+}
+
+/*
+ * free_meta_size - Returns how many bytes at the start of a free block of
+ *                  the given size hold its header and list links (all
+ *                  lanes) or tree node. coalesce_block clears these when
+ *                  it merges fresh blocks; mm_calloc clears the most any
+ *                  size needs, a tree block's, since the lanes fit in a
+ *                  tree node.
+ */
+static size_t free_meta_size(size_t size)
+{
+    block_t *block = NULL;
+
+    if (size >= tree_min) {
+        return offsetof(block_t, payload) + sizeof(block->payload.node);
+    }
+
+    // As many skip-list lanes as address-ordered placement may have used
+    size_t lanes = (size > min_block_size) ? (size - dsize) / sizeof(block->payload.links) : 1;
+
+    if (lanes > SKIP_LEVELS) {
+        lanes = SKIP_LEVELS;
+    }
+    return offsetof(block_t, payload) + lanes * sizeof(block->payload.links);
+}
+
+/*
+ * tree_is_red - Returns whether a tree node is red; missing children count
+ *               as black.
+ */
+static bool tree_is_red(block_t *node)
+{
+    return node != NULL && node->payload.node.red;
+}
+
+/*
+ * tree_replace - Put node (possibly NULL) where old hangs from its parent,
+ *                or at the root.
+ */
+static void tree_replace(arena_t *arena, block_t *old, block_t *node)
+{
+    block_t *parent = old->payload.node.parent;
+
+    if (parent == NULL) {
+        arena->tree_root = node;
+    } else {
+        parent->payload.node.child[parent->payload.node.child[1] == old] = node;
+    }
+    if (node != NULL) {
+        node->payload.node.parent = parent;
+    }
+}
+
+/*
+ * tree_rotate - Rotate the subtree at node towards dir (0 = left, 1 =
+ *               right): its child on the other side takes its place.
+ */
+static void tree_rotate(arena_t *arena, block_t *node, int dir)
+{
+    block_t *pivot = node->payload.node.child[!dir];
+    block_t *inner = pivot->payload.node.child[dir];
+
+    node->payload.node.child[!dir] = inner;
+    if (inner != NULL) {
+        inner->payload.node.parent = node;
+    }
+
+    tree_replace(arena, node, pivot);
+
+    pivot->payload.node.child[dir] = node;
+    node->payload.node.parent = pivot;
+}
+
+/*
+ * tree_insert - Add a free block to the tree, keyed by size and then by
+ *               address so that every key is distinct, and rebalance.
+ */
+static void tree_insert(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+    block_t *parent = NULL;
+    block_t *curr = arena->tree_root;
+    int dir = 0;
+
+    while (curr != NULL) {
+        size_t csize = get_size(curr);
+
+        parent = curr;
+        dir = (size > csize || (size == csize && block > curr));
+        curr = curr->payload.node.child[dir];
+    }
+
+    block->payload.node.child[0] = NULL;
+    block->payload.node.child[1] = NULL;
+    block->payload.node.parent = parent;
+    block->payload.node.red = true;
+
+    if (parent == NULL) {
+        arena->tree_root = block;
+    } else {
+        parent->payload.node.child[dir] = block;
+    }
+
+    // Fix red parent of a red node, walking up
+    while (tree_is_red(block->payload.node.parent)) {
+        parent = block->payload.node.parent;
+        block_t *grand = parent->payload.node.parent;
+        int side = (grand->payload.node.child[1] == parent);
+        block_t *uncle = grand->payload.node.child[!side];
+
+        if (tree_is_red(uncle)) {
+            parent->payload.node.red = false;
+            uncle->payload.node.red = false;
+            grand->payload.node.red = true;
+            block = grand;
+            continue;
+        }
+
+        if (parent->payload.node.child[!side] == block) {
+            tree_rotate(arena, parent, side);
+            block = parent;
+            parent = block->payload.node.parent;
+        }
+
+        parent->payload.node.red = false;
+        grand->payload.node.red = true;
+        tree_rotate(arena, grand, !side);
+    }
+
+    arena->tree_root->payload.node.red = false;
+}
+
+/*
+ * tree_remove - Take a free block out of the tree and rebalance.
+ */
+static void tree_remove(arena_t *arena, block_t *block)
+{
+    block_t *left = block->payload.node.child[0];
+    block_t *right = block->payload.node.child[1];
+    block_t *child;     // Node moved into the vacated position
+    block_t *parent;    // Its parent afterwards
+    bool removed_red;
+
+    if (left == NULL || right == NULL) {
+        child = (left != NULL) ? left : right;
+        parent = block->payload.node.parent;
+        removed_red = block->payload.node.red;
+        tree_replace(arena, block, child);
+    } else {
+        // Two children: the in-order successor takes over our position
+        block_t *succ = right;
+
+        while (succ->payload.node.child[0] != NULL) {
+            succ = succ->payload.node.child[0];
+        }
+
+        child = succ->payload.node.child[1];
+        removed_red = succ->payload.node.red;
+
+        if (succ == right) {
+            parent = succ;
+        } else {
+            parent = succ->payload.node.parent;
+            tree_replace(arena, succ, child);
+            succ->payload.node.child[1] = right;
+            right->payload.node.parent = succ;
+        }
+
+        tree_replace(arena, block, succ);
+        succ->payload.node.child[0] = left;
+        left->payload.node.parent = succ;
+        succ->payload.node.red = block->payload.node.red;
+    }
+
+    if (removed_red) {
+        return;
+    }
+
+    // A black node left; child's side is one black short
+    while (child != arena->tree_root && !tree_is_red(child)) {
+        int side = (parent->payload.node.child[1] == child);
+        block_t *sibling = parent->payload.node.child[!side];
+
+        if (tree_is_red(sibling)) {
+            sibling->payload.node.red = false;
+            parent->payload.node.red = true;
+            tree_rotate(arena, parent, side);
+            sibling = parent->payload.node.child[!side];
+        }
+
+        if (!tree_is_red(sibling->payload.node.child[0]) &&
+            !tree_is_red(sibling->payload.node.child[1])) {
+            sibling->payload.node.red = true;
+            child = parent;
+            parent = child->payload.node.parent;
+            continue;
+        }
+
+        if (!tree_is_red(sibling->payload.node.child[!side])) {
+            sibling->payload.node.child[side]->payload.node.red = false;
+            sibling->payload.node.red = true;
+            tree_rotate(arena, sibling, !side);
+            sibling = parent->payload.node.child[!side];
+        }
+
+        sibling->payload.node.red = parent->payload.node.red;
+        parent->payload.node.red = false;
+        sibling->payload.node.child[!side]->payload.node.red = false;
+        tree_rotate(arena, parent, side);
+        child = arena->tree_root;
+    }
+
+    if (child != NULL) {
+        child->payload.node.red = false;
+    }
+}
+
+/*
+ * tree_best_fit - Returns the smallest free block in the tree of at least
+ *                 asize bytes (the lowest addressed one among equals), or
+ *                 NULL if there is none. Adds the nodes visited to *steps.
+ */
+static block_t *tree_best_fit(arena_t *arena, size_t asize, size_t *steps)
+{
+    block_t *best = NULL;
+    block_t *curr = arena->tree_root;
+
+    while (curr != NULL) {
+        (*steps)++;
+        if (get_size(curr) >= asize) {
+            best = curr;
+            curr = curr->payload.node.child[0];
+        } else {
+            curr = curr->payload.node.child[1];
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Finds a free block that of size at least asize.
+ *
+ * The home class of asize is searched as the placement policy says (exact
+ * classes hit on the first block looked at, range classes may hold blocks
+ * that are too small). Failing that, every block in any higher non-empty
+ * class is big enough, so the lowest such class is searched the same way;
+ * it is located with one find-first-set on seg_bitmap instead of probing
+ * empty lists. Requests of tree_min bytes or more, and smaller ones no
+ * list can serve, take the best fit from the tree.
+ */
+static block_t *find_fit(arena_t *arena, size_t asize)
+{
+    block_t *fit = NULL;
+    size_t steps = 0;
+
+    if (asize < tree_min) {
+        size_t idx = size_class(asize);
+
+        fit = list_fit(arena, idx, asize, &steps);
+
+        uint64_t avail = (idx + 1 < SEG_CLASSES) ?
+            arena->seg_bitmap & (~(uint64_t) 0 << (idx + 1)) : 0;
+        if (fit == NULL && avail != 0) {
+            fit = list_fit(arena, __builtin_ctzll(avail), asize, &steps);
+        }
+    }
+
+    if (fit == NULL) {
+        fit = tree_best_fit(arena, asize, &steps);  // Smallest block in the tree, if any
+    }
+
+    stats_fit(arena, steps);
+
+    return fit;
+}
+
+/*
+ * list_fit - Search list idx for a block of at least asize bytes under
+ *            the arena's placement policy, counting the blocks looked at
+ *            in *steps. Returns NULL if none fits.
+ */
+static block_t *list_fit(arena_t *arena, size_t idx, size_t asize, size_t *steps)
+{
+    block_t *head = arena->seg_lists[idx];
+    block_t *start = head;
+    block_t *best = NULL;
+    size_t seen = 0;
+    bool wrapped = false;
+
+    if (arena->placement == MM_PLACE_NEXT_FIT && arena->seg_rovers[idx] != NULL) {
+        start = arena->seg_rovers[idx];
+    }
+
+    for (block_t *curr = start; curr != NULL; ) {
+        (*steps)++;
+
+        if (get_size(curr) >= asize) {
+            if (arena->placement != MM_PLACE_BEST_OF) {
+                best = curr;
+                break;
+            }
+            if (best == NULL || get_size(curr) < get_size(best)) {
+                best = curr;
+            }
+            if (get_size(curr) == asize || ++seen >= best_of) {
+                break;
+            }
+        }
+
+        curr = lane_next(arena, curr, 0);
+
+        if (curr == NULL && !wrapped && start != head) {
+            curr = head;        // Next-fit goes round to the blocks before the rover
+            wrapped = true;
+        }
+        if (wrapped && curr == start) {
+            break;
+        }
+    }
+
+    if (best != NULL && arena->placement == MM_PLACE_NEXT_FIT) {
+        arena->seg_rovers[idx] = lane_next(arena, best, 0);
+    }
+
+    return best;
+}
+
+/*
+ * Coalesces current block with previous and next blocks if either or both are unallocated.
+ * The block must be marked free and must not be on a free list; free neighbours are
+ * unlinked from their lists and the merged block is inserted into the list for its
+ * (new) size class. Returns pointer to the coalesced block. After coalescing, the
+ * immediate contiguous previous and next blocks must be allocated.
+ */
+static block_t *coalesce_block(arena_t *arena, block_t *block)
+{
+    block_t *next_block = find_next(block);
+    size_t combined_block = get_size(block);
+    bool prev_alloc = get_prev_alloc(block);
+    bool fresh = get_fresh(block);
+    size_t purged = 0;      // Pages the merged neighbours had purged; still purged
+
+    if (get_alloc(next_block) == 0)        //If the next block is also free
+    {
+        if (get_size(next_block) >= tree_min) {
+            purged += next_block->payload.node.purged;
+        }
+        remove_block(arena, next_block);
+        stats_coalesce(arena);
+
+        if (fresh && get_fresh(next_block)) {
+            // Our footer and its header and links end up inside the payload
+            zero_words(header_to_footer(block), wsize + free_meta_size(get_size(next_block)));
+        }
+        fresh = fresh && get_fresh(next_block);
+        combined_block += get_size(next_block);
+    }
+
+    if (prev_alloc == 0)     //If the previous block is also free, its footer is valid
+    {
+        block_t *prev_block = find_prev(block);
+
+        if (get_size(prev_block) >= tree_min) {
+            purged += prev_block->payload.node.purged;
+        }
+        remove_block(arena, prev_block);
+        stats_coalesce(arena);
+
+        if (fresh && get_fresh(prev_block)) {
+            // Its footer and our header and links; a mini block's links stand in for the footer
+            zero_words(find_prev_footer(block), wsize + free_meta_size(get_size(block)));
+        }
+        fresh = fresh && get_fresh(prev_block);
+        combined_block += get_size(prev_block);
+
+        block = prev_block;      //This is needed for if there are three in a row that are free
+        prev_alloc = get_prev_alloc(prev_block);
+    }
+
+    write_header(block, combined_block, 0, prev_alloc);
+    write_footer(block, combined_block);
+    write_fresh(block, fresh);
+    write_prev_alloc(find_next(block), false);
+
+    insert_block(arena, block);
+
+    if (purged != 0) {
+        block->payload.node.purged = purged;
+        arena->purged_bytes += purged * mem_pagesize();
+    }
+
+    return block;
+}
+
+/*
+ * See if new block can be split one to satisfy allocation
+ * and one to keep free. purged of the span pages purge_span gave for the
+ * free block this one was taken from were purged (0 and 0 if it was not
+ * taken off the free lists just now); the free part keeps its share.
+ */
+static void split_block(arena_t *arena, block_t *block, size_t asize, size_t purged, size_t span)
+{
+    
+	if((get_size(block) - asize) >= min_block_size)          //If the block has enough leftover to be more than the minimum size
+    {
+        size_t next_block_size = get_size(block) - asize;
+        bool fresh = get_fresh(block);                          //Both halves inherit freshness
+
+        stats_split(arena);
+
+        write_header(block, asize, 1, get_prev_alloc(block));   //rewrite the header to only use the space needed
+        write_fresh(block, fresh);
+
+        write_header(find_next(block), next_block_size, 0, 1);  //write header and footer for the new free part
+        write_footer(find_next(block), next_block_size);
+        write_fresh(find_next(block), fresh);
+
+        size_t share = purged_share(purged, span, purge_span(arena, find_next(block), NULL));
+
+        block_t *rest = coalesce_block(arena, find_next(block));   //Files the remainder under its own size class
+
+        keep_purged(arena, rest, share);        //Its pages are still purged
+    }
+
+  // remove_block(arena, block); //Coalesce has the remove stuff I need so don't need this here
+
+    return;
+
+}
+
+
+/*
+ * Extends the heap with the requested number of bytes, and recreates end header. 
+ * Returns a pointer to the result of coalescing the newly-created block with previous free block, 
+ * if applicable, or NULL in failure.
+ */
+static block_t *extend_heap(arena_t *arena, size_t size) 
+{
+    void *bp;
+
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+    if (size > link_span - arena_heap_size(arena)) {
+        return NULL;        // Free-list links could no longer reach the top
+    }
+    if ((bp = arena_sbrk(arena, (intptr_t) size)) == (void *)-1) {
+        return NULL;
+    }
+
+    stats_extend(arena, size);
+
+    // bp is a pointer to the new memory block requested
+     
+    // TODO: Implement extend_heap.
+   
+
+    bp = find_prev_footer(bp);  //old epilogue header is this blocks header
+
+    block_t *bp_next;
+
+    write_header( bp, size, 0, get_prev_alloc(bp));  //The old epilogue already knows whether the block before it is allocated
+    write_fresh( bp, true);      //New heap memory is zero filled
+
+    bp_next = find_next(bp);
+     
+
+    write_header( bp_next, 0, 1, 0);
+    write_footer( bp, size);     //Needs the epilogue in place for the prev_mini bit
+
+  
+
+    return coalesce_block(arena, bp); 
+
+
+
+  
+   
+}
+
+/*
+ * grow_heap - Extend the heap by at least need bytes for a request that no
+ *             free block can hold, returning the free block now ending the
+ *             heap (merged with any free block that ended it before), or
+ *             NULL if the arena is out of memory.
+ *
+ * The heap grows by the larger of need and the arena's growth step. The
+ * step starts at grow_min and doubles with each miss, up to grow_max and
+ * never past an eighth of the heap's current size, so a run of misses
+ * costs few extensions while the slack stays a small fraction of the
+ * heap; trim_heap halves it again when the heap shrinks. Caller holds the
+ * heap lock.
+ */
+static block_t *grow_heap(arena_t *arena, size_t need)
+{
+    size_t size = max(need, arena->grow_next);
+    uintptr_t brk = (uintptr_t) arena_brk(arena);
+
+    if (arena->grain > mem_pagesize()) {
+        size = round_up(brk + size, arena->grain) - brk;    // End on a huge page boundary
+    }
+
+    block_t *block = extend_heap(arena, size);
+
+    if (block == NULL && size > need) {
+        block = extend_heap(arena, need);       // There may still be room for the request alone
+    }
+
+    size_t step = 2 * arena->grow_next;
+
+    if (step > grow_max) {
+        step = grow_max;
+    }
+    if (step > arena_heap_size(arena) / 8) {
+        step = arena_heap_size(arena) / 8;
+    }
+    arena->grow_next = max(step, grow_min);
+
+    return block;
+}
+
+/*
+ * top_free_block - Returns the free block ending the heap, or NULL if the
+ *                  last block is allocated. A heap extension merges with
+ *                  that block, so a miss only needs the difference.
+ */
+static block_t *top_free_block(arena_t *arena)
+{
+    block_t *epilogue = (block_t *) (arena_brk(arena) - wsize);
+
+    return get_prev_alloc(epilogue) ? NULL : find_prev(epilogue);
+}
+
+/*
+ * trim_heap - Shrink a free block that ends the heap to the arena's growth
+ *             step (at least chunksize bytes), returning the rest to the
+ *             system, and halve the step. The new break is aligned to the
+ *             arena's grain so that everything past it is released whole.
+ *             Leaves the heap alone if the break cannot be lowered. Caller
+ *             holds the heap lock.
+ */
+static void trim_heap(arena_t *arena, block_t *block)
+{
+    size_t size = get_size(block);
+    size_t keep = max(arena->grow_next, chunksize);
+    uintptr_t old_brk = (uintptr_t) block + size + wsize;
+    uintptr_t new_brk = round_up((uintptr_t) block + keep + wsize, arena->grain);
+
+    if (new_brk >= old_brk) {
+        return;
+    }
+
+    if (arena_sbrk(arena, -(intptr_t) (old_brk - new_brk)) == (void *) -1) {
+        return;
+    }
+
+    bool fresh = get_fresh(block);
+    size_t span = purge_span(arena, block, NULL);
+    size_t purged = remove_block(arena, block);
+
+    size = new_brk - wsize - (uintptr_t) block;
+    write_header(block, size, 0, get_prev_alloc(block));
+    write_fresh(block, fresh);
+
+    write_header(find_next(block), 0, 1, 0);   // New epilogue
+    write_footer(block, size);
+
+    insert_block(arena, block);
+    keep_purged(arena, block, purged_share(purged, span, purge_span(arena, block, NULL)));
+
+    arena->grow_next = max(arena->grow_next / 2, grow_min);
+}
+
+/*
+ * coarse_ms - Returns a cheap monotonic clock in milliseconds, good to a
+ *             few of them.
+ */
+static uint64_t coarse_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * purge_tick - Count a free in the arena; every purge_tick_mask + 1 of
+ *              them, read the clock and run purge_arena if decay_ms has
+ *              passed since it last ran. Caller holds the heap lock.
+ */
+static void purge_tick(arena_t *arena)
+{
+    if ((++arena->purge_ticks & purge_tick_mask) != 0) {
+        return;
+    }
+
+    arena->purge_now = coarse_ms();
+
+    if (arena->purge_now - arena->purge_last >= decay_ms) {
+        purge_arena(arena);
+    }
+}
+
+/*
+ * purge_arena - Give back what has been free for decay_ms: the interior
+ *               pages of old free blocks in the tree, and old empty slab
+ *               runs. Caller holds the heap lock.
+ */
+static void purge_arena(arena_t *arena)
+{
+    arena->purge_last = arena->purge_now;
+
+    purge_tree(arena, arena->tree_root);
+
+    slab_run_t **link = &arena->slab_dirty;
+
+    while (*link != NULL) {
+        slab_run_t *run = *link;
+
+        if (arena->purge_now - run->freed_at >= decay_ms) {
+            *link = run->next;
+            slab_release(run);
+            stats_purge(arena);
+        } else {
+            link = &run->next;
+        }
+    }
+}
+
+/*
+ * purge_tree - purge_block every block in the subtree at node that has
+ *              been in the tree for decay_ms.
+ */
+static void purge_tree(arena_t *arena, block_t *node)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    if (arena->purge_now - node->payload.node.freed_at >= decay_ms) {
+        purge_block(arena, node);
+    }
+
+    purge_tree(arena, node->payload.node.child[0]);
+    purge_tree(arena, node->payload.node.child[1]);
+}
+
+/*
+ * purge_block - Release the whole pages inside a free block with
+ *               MADV_DONTNEED, keeping the pages holding its header, tree
+ *               node and footer. Huge pages are only released whole. They read as zero when next touched, so
+ *               a fresh block stays fresh. The block records how many
+ *               pages are purged, which arena->purged_bytes adds up, so
+ *               that purging again only adds pages merged in since and
+ *               reusing the block takes them off exactly once. Caller
+ *               holds the heap lock.
+ */
+static void purge_block(arena_t *arena, block_t *block)
+{
+    size_t page = mem_pagesize();
+    uintptr_t lo;
+    size_t pages = purge_span(arena, block, &lo);
+
+    if (pages == 0 || pages == block->payload.node.purged) {
+        return;
+    }
+
+    if (madvise((void *) lo, pages * page, MADV_DONTNEED) != 0) {
+        return;
+    }
+
+    arena->purged_bytes += (pages - (size_t) block->payload.node.purged) * page;
+    block->payload.node.purged = (uint32_t) pages;
+    stats_purge(arena);
+}
+
+/*
+ * purge_span - Returns how many pages purge_block would release from free
+ *              block, storing where they start in *lo unless lo is NULL.
+ */
+static size_t purge_span(arena_t *arena, block_t *block, uintptr_t *lo)
+{
+    size_t size = get_size(block);
+    uintptr_t start = round_up((uintptr_t) block + free_meta_size(size), arena->grain);
+    uintptr_t end = ((uintptr_t) block + size - wsize) & ~(uintptr_t) (arena->grain - 1);
+
+    if (lo != NULL) {
+        *lo = start;
+    }
+    return (end > start) ? (end - start) / mem_pagesize() : 0;
+}
+
+/*
+ * purged_share - Of a free block's span pages, purged were purged. Returns
+ *                how many of part pages lying among them must still be:
+ *                all of them if the whole block was purged, fewer if its
+ *                resident pages may lie in the part.
+ */
+static size_t purged_share(size_t purged, size_t span, size_t part)
+{
+    size_t resident = (span > purged) ? span - purged : 0;
+
+    return (part > resident) ? part - resident : 0;
+}
+
+/*
+ * keep_purged - Count pages more of free block as purged, after it was
+ *               filed by insert_block or coalesce_block. Only tree blocks
+ *               keep a count; a list block's pages are taken as resident.
+ */
+static void keep_purged(arena_t *arena, block_t *block, size_t pages)
+{
+    if (pages == 0 || get_size(block) < tree_min) {
+        return;
+    }
+
+    block->payload.node.purged += (uint32_t) pages;
+    arena->purged_bytes += pages * mem_pagesize();
+}
+
+/*
+ * heap_lock / heap_unlock - Serialize access to an arena. No-ops unless
+ *                           built with MM_THREAD_SAFE.
+ */
+static void heap_lock(arena_t *arena)
+{
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#else
+    (void) arena;
+#endif
+}
+
+static void heap_unlock(arena_t *arena)
+{
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#else
+    (void) arena;
+#endif
+}
+
+/*
+ * arena_sbrk - Move the arena's break by incr bytes, like sbrk, returning
+ *              the old break, or (void *) -1 if the arena's memory is
+ *              exhausted or (for the main arena) memlib cannot shrink the
+ *              heap. New memory is zero filled, so pages given back by a
+ *              negative incr must read as zero when the heap grows again.
+ */
+static void *arena_sbrk(arena_t *arena, intptr_t incr)
+{
+#ifdef MM_THREAD_SAFE
+    if (arena != &main_arena) {
+        unsigned char *old_brk = arena->brk;
+
+        if (incr < 0) {
+            unsigned char *new_brk = old_brk + incr;
+            unsigned char *page = (unsigned char *) round_up((uintptr_t) new_brk, mem_pagesize());
+
+            if (page < old_brk) {
+                madvise(page, old_brk - page, MADV_DONTNEED);
+            }
+            arena->brk = new_brk;
+            return old_brk;
+        }
+
+        if ((size_t) incr > (size_t) (arena->end - old_brk)) {
+            return (void *) -1;
+        }
+        arena->brk = old_brk + incr;
+        return old_brk;
+    }
+#else
+    (void) arena;
+#endif
+    return mem_sbrk(incr);
+}
+
+/*
+ * arena_brk - Returns the arena's current break, one byte past its heap.
+ */
+static unsigned char *arena_brk(arena_t *arena)
+{
+#ifdef MM_THREAD_SAFE
+    if (arena != &main_arena) {
+        return arena->brk;
+    }
+#else
+    (void) arena;
+#endif
+    return (unsigned char *) mem_heap_hi() + 1;
+}
+
+/*
+ * arena_heap_size - Returns the size of the arena's heap (bytes).
+ */
+static size_t arena_heap_size(arena_t *arena)
+{
+#ifdef MM_THREAD_SAFE
+    if (arena != &main_arena) {
+        return arena->brk - (unsigned char *) arena - round_up(sizeof(arena_t), dsize);
+    }
+#else
+    (void) arena;
+#endif
+    return mem_heapsize();
+}
+
+/*
+ * arena_of - Returns the arena a block belongs to: the region arena whose
+ *            slice of the region reservation contains it, or else the main
+ *            arena.
+ */
+static arena_t *arena_of(block_t *block)
+{
+#ifdef MM_THREAD_SAFE
+    unsigned char *base = __atomic_load_n(&regions_base, __ATOMIC_ACQUIRE);
+    size_t offset = (unsigned char *) block - base;
+
+    if (base != NULL && offset < regions_span) {
+        return (arena_t *) (base + offset / arena_region_size * arena_region_size);
+    }
+#else
+    (void) block;
+#endif
+    return &main_arena;
+}
+
+#ifdef MM_THREAD_SAFE
+
+/*
+ * arena_create - Place arena number slot (>= 1) at the start of its slice
+ *                of the region reservation and lay out an empty heap after
+ *                it. Returns NULL if the heap cannot be set up.
+ */
+static arena_t *arena_create(unsigned slot)
+{
+    unsigned char *base = regions_base + (size_t) (slot - 1) * arena_region_size;
+    arena_t *arena = (arena_t *) base;
+
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->brk = base + round_up(sizeof(arena_t), dsize);
+    arena->end = base + arena_region_size;
+
+    if (arena_init_heap(arena) < 0) {
+        return NULL;
+    }
+
+    return arena;
+}
+
+/*
+ * arena_reserve - Decide how many arenas to use (one per online CPU, at
+ *                 most MAX_ARENAS) and reserve address space for all the
+ *                 region arenas. If the reservation fails everything runs
+ *                 on the main arena. Caller holds arenas_mutex.
+ */
+static void arena_reserve(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned count = (cpus < 1) ? 1 : (cpus > MAX_ARENAS) ? MAX_ARENAS : (unsigned) cpus;
+
+    if (count > 1) {
+        size_t span = (size_t) (count - 1) * arena_region_size;
+        size_t huge = mem_hugepagesize();
+        unsigned char *base = mmap(NULL, span + huge, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (base == MAP_FAILED) {
+            count = 1;
+        } else {
+            // Regions start on huge page boundaries, for huge page mode
+            unsigned char *aligned = (unsigned char *) round_up((uintptr_t) base, huge);
+
+            if (aligned > base) {
+                munmap(base, aligned - base);
+            }
+            munmap(aligned + span, base + huge - aligned);
+
+            regions_span = span;
+            __atomic_store_n(&regions_base, aligned, __ATOMIC_RELEASE);
+        }
+    }
+
+    arena_count = count;
+}
+
+/*
+ * arena_self - Returns the calling thread's arena, assigning one on first
+ *              use. Threads are dealt out round-robin over arena_count
+ *              arenas; an arena is created the first time a thread is
+ *              assigned to it. tcache_release takes the thread off it again.
+ */
+static arena_t *arena_self(void)
+{
+    if (thread_arena != NULL) {
+        return thread_arena;
+    }
+
+    pthread_mutex_lock(&arenas_mutex);
+
+    if (arena_count == 0) {
+        arena_reserve();
+    }
+
+    unsigned slot = arena_next++ % arena_count;
+
+    if (arenas[slot] == NULL) {
+        arenas[slot] = arena_create(slot);
+    }
+    thread_arena = (arenas[slot] != NULL) ? arenas[slot] : &main_arena;
+    __atomic_add_fetch(&thread_arena->threads, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&arenas_mutex);
+
+    // tcache_release takes the thread off the arena when it exits; set the
+    // key here too, as a thread may come back after it ran
+    pthread_setspecific(tcache_key, tcache_self());
+
+    return thread_arena;
+}
+
+#else
+
+static arena_t *arena_self(void)
+{
+    return &main_arena;
+}
+
+#endif /* MM_THREAD_SAFE */
+
+/*
+ * remote_drain - Free everything threads of other arenas pushed on the
+ *                arena's remote-free stack, taking it all in one swap.
+ *                Costs one load when it is empty. Caller holds the heap
+ *                lock.
+ */
+static void remote_drain(arena_t *arena)
+{
+#ifdef MM_THREAD_SAFE
+    if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL) {
+        return;
+    }
+
+    void *p = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+
+    while (p != NULL) {
+        void *next = *(void **) p;
+
+        if (slab_owns(p)) {
+            slab_free(slab_run_of(p), p);
+        } else {
+            free_block(arena, payload_to_header(p));
+        }
+        p = next;
+        n++;
+    }
+
+    stats_remote(arena, n);
+#else
+    (void) arena;
+#endif
+}
+
+#ifdef MM_THREAD_SAFE
+
+/*
+ * remote_push - Free the block or slab slot at payload p of another
+ *               thread's arena without its lock: push it on the arena's
+ *               remote-free stack. Any number of threads push; the only
+ *               pop is remote_drain taking the whole stack, so a CAS on
+ *               the head is enough and ABA cannot arise.
+ */
+static void remote_push(arena_t *arena, void *p)
+{
+    void *head = __atomic_load_n(&arena->remote, __ATOMIC_RELAXED);
+
+    do {
+        *(void **) p = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote, &head, p, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_free - Free the block or slab slot at payload p of an arena that
+ *               is not the calling thread's. The caller holds the lock of
+ *               *locked, or none if it is NULL. If the arena's lock can be
+ *               had without waiting, or the arena has no threads left to
+ *               drain its remote stack, p is freed under that lock, and
+ *               the caller holds it instead of *locked on return, with
+ *               *locked updated; otherwise p is pushed for the arena's
+ *               threads and *locked is left as it is.
+ */
+static void remote_free(arena_t *arena, void *p, arena_t **locked)
+{
+    if (arena != *locked) {
+        bool orphaned = __atomic_load_n(&arena->threads, __ATOMIC_SEQ_CST) == 0;
+
+        if (!orphaned && pthread_mutex_trylock(&arena->lock) != 0) {
+            remote_push(arena, p);
+
+            // The last thread may have left and drained since the check;
+            // it orders its exit against the push the same way
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&arena->threads, __ATOMIC_RELAXED) != 0) {
+                return;
+            }
+            p = NULL;       // Now on the stack; drained below
+        }
+
+        if (*locked != NULL) {
+            heap_unlock(*locked);
+        }
+        if (orphaned || p == NULL) {
+            heap_lock(arena);
+        }
+        *locked = arena;
+    }
+
+    remote_drain(arena);
+
+    if (p == NULL) {
+        return;
+    }
+    if (slab_owns(p)) {
+        slab_free(slab_run_of(p), p);
+    } else {
+        free_block(arena, payload_to_header(p));
+    }
+}
+
+static void tcache_make_key(void)
+{
+    pthread_key_create(&tcache_key, tcache_release);
+}
+
+/*
+ * tcache_self - Returns the calling thread's cache, emptying it first if it
+ *               was filled before the last mm_init, and registering it to
+ *               be flushed when the thread exits.
+ */
+static tcache_t *tcache_self(void)
+{
+    tcache_t *tc = &tcache;
+
+    if (tc->generation != heap_generation) {
+        memset(tc, 0, sizeof(*tc));
+        tc->generation = heap_generation;
+
+        pthread_once(&tcache_key_once, tcache_make_key);
+        pthread_setspecific(tcache_key, tc);
+    }
+
+    return tc;
+}
+
+/*
+ * tcache_bin: maps a cached block size to its bin
+ */
+static size_t tcache_bin(size_t size)
+{
+    return (size - min_block_size) / dsize;
+}
+
+/*
+ * tcache_get - Pop a block of asize bytes from the calling thread's cache.
+ *              An empty bin is refilled with tcache_batch blocks from the
+ *              thread's arena under a single lock acquisition. Returns NULL
+ *              if the arena is full.
+ */
+static block_t *tcache_get(size_t asize)
+{
+    tcache_t *tc = tcache_self();
+    size_t bin = tcache_bin(asize);
+    block_t *block = tc->bins[bin];
+
+    if (block == NULL) {
+        arena_t *arena = arena_self();
+
+        heap_lock(arena);
+        remote_drain(arena);
+        for (unsigned i = 0; i < tcache_batch; i++) {
+            bool fresh;
+            block_t *fill = malloc_block(arena, asize, &fresh);
+            if (fill == NULL) {
+                break;
+            }
+            fill->payload.chain = block;
+            block = fill;
+            tc->counts[bin]++;
+        }
+        heap_unlock(arena);
+
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    tc->bins[bin] = block->payload.chain;
+    tc->counts[bin]--;
+
+    return block;
+}
+
+/*
+ * tcache_put - Cache an allocated block of size bytes for reuse by this
+ *              thread. A full bin first hands tcache_batch blocks back to
+ *              the heap. Returns false if the block is too large to cache.
+ */
+static bool tcache_put(block_t *block, size_t size)
+{
+    if (size > tcache_max) {
+        return false;
+    }
+
+    tcache_t *tc = tcache_self();
+    size_t bin = tcache_bin(size);
+
+    if (tc->counts[bin] >= tcache_count) {
+        tcache_flush(tc, bin, tcache_batch);
+    }
+
+    block->payload.chain = tc->bins[bin];
+    tc->bins[bin] = block;
+    tc->counts[bin]++;
+
+    return true;
+}
+
+/*
+ * tcache_flush - Free up to n blocks from one bin back to their arenas:
+ *                the thread's own under its lock, taken once, and other
+ *                arenas' through their remote-free stacks.
+ */
+static void tcache_flush(tcache_t *tc, size_t bin, unsigned n)
+{
+    arena_t *locked = NULL;
+
+    while (n-- > 0 && tc->bins[bin] != NULL) {
+        block_t *block = tc->bins[bin];
+        arena_t *arena = arena_of(block);
+
+        if (arena != thread_arena) {
+            tc->bins[bin] = block->payload.chain;
+            tc->counts[bin]--;
+            remote_free(arena, header_to_payload(block), &locked);
+            continue;
+        }
+
+        if (arena != locked) {
+            if (locked != NULL) {
+                heap_unlock(locked);
+            }
+            heap_lock(arena);
+            locked = arena;
+        }
+
+        tc->bins[bin] = block->payload.chain;
+        tc->counts[bin]--;
+        free_block(arena, block);
+    }
+
+    if (locked != NULL) {
+        heap_unlock(locked);
+    }
+}
+
+/*
+ * tcache_release - Thread exit destructor: return every cached block, then
+ *                  leave the thread's arena, draining its remote stack on
+ *                  the way out in case no other thread is left to.
+ */
+static void tcache_release(void *arg)
+{
+    tcache_t *tc = arg;
+    arena_t *arena = thread_arena;
+
+    if (tc->generation == heap_generation) {
+        for (size_t bin = 0; bin < TCACHE_BINS; bin++) {
+            tcache_flush(tc, bin, tcache_count);
+        }
+        for (size_t cls = 0; cls < SLAB_CLASSES; cls++) {
+            tcache_flush_slots(tc, cls, tcache_count);
+        }
+    }
+
+    if (arena == NULL) {
+        return;
+    }
+
+    // Pairs with the fence in remote_free: a push this drain misses sees
+    // the arena empty of threads and drains it itself
+    __atomic_sub_fetch(&arena->threads, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    thread_arena = NULL;
+
+    heap_lock(arena);
+    remote_drain(arena);
+    heap_unlock(arena);
+}
+
+/*
+ * tcache_get_slot - Pop a slot of class cls from the calling thread's
+ *                   cache, refilling an empty bin with tcache_batch slots
+ *                   from the thread's arena under one lock acquisition.
+ *                   Returns NULL if no run can be had.
+ */
+static void *tcache_get_slot(size_t cls)
+{
+    tcache_t *tc = tcache_self();
+    void *slot = tc->slots[cls];
+
+    if (slot == NULL) {
+        arena_t *arena = arena_self();
+
+        heap_lock(arena);
+        remote_drain(arena);
+        for (unsigned i = 0; i < tcache_batch; i++) {
+            bool fresh;
+            void *fill = slab_alloc(arena, cls, &fresh);
+            if (fill == NULL) {
+                break;
+            }
+            *(void **) fill = slot;
+            slot = fill;
+            tc->slot_counts[cls]++;
+        }
+        heap_unlock(arena);
+
+        if (slot == NULL) {
+            return NULL;
+        }
+    }
+
+    tc->slots[cls] = *(void **) slot;
+    tc->slot_counts[cls]--;
+
+    return slot;
+}
+
+/*
+ * tcache_put_slot - Cache a slot of run for reuse by this thread, first
+ *                   flushing tcache_batch slots if its bin is full.
+ */
+static void tcache_put_slot(void *p, slab_run_t *run)
+{
+    tcache_t *tc = tcache_self();
+    size_t cls = run->cls;
+
+    if (tc->slot_counts[cls] >= tcache_count) {
+        tcache_flush_slots(tc, cls, tcache_batch);
+    }
+
+    *(void **) p = tc->slots[cls];
+    tc->slots[cls] = p;
+    tc->slot_counts[cls]++;
+}
+
+/*
+ * tcache_flush_slots - Return up to n cached slots of class cls to their
+ *                      runs, as tcache_flush does blocks.
+ */
+static void tcache_flush_slots(tcache_t *tc, size_t cls, unsigned n)
+{
+    arena_t *locked = NULL;
+
+    while (n-- > 0 && tc->slots[cls] != NULL) {
+        void *slot = tc->slots[cls];
+        slab_run_t *run = slab_run_of(slot);
+
+        if (run->arena != thread_arena) {
+            tc->slots[cls] = *(void **) slot;
+            tc->slot_counts[cls]--;
+            remote_free(run->arena, slot, &locked);
+            continue;
+        }
+
+        if (run->arena != locked) {
+            if (locked != NULL) {
+                heap_unlock(locked);
+            }
+            heap_lock(run->arena);
+            locked = run->arena;
+        }
+
+        tc->slots[cls] = *(void **) slot;
+        tc->slot_counts[cls]--;
+        slab_free(run, slot);
+    }
+
+    if (locked != NULL) {
+        heap_unlock(locked);
+    }
+}
+
+#endif /* MM_THREAD_SAFE */
+
+/*
+ * mmap_alloc - Map a block with room for size bytes of payload aligned to
+ *              alignment (a power of two, at least 16). The payload starts
+ *              alignment bytes into the mapping, or one page in if the
+ *              alignment is larger than that, with the header in the word
+ *              before it; either way the header lies in the mapping's first
+ *              page, so mmap_base finds the mapping again. The header
+ *              records the page-rounded mapping length. Returns NULL if
+ *              the mapping fails.
+ */
+static block_t *mmap_alloc(size_t size, size_t alignment)
+{
+    size_t page = mem_pagesize();
+    size_t offset = (alignment < page) ? alignment : page;
+    size_t len = round_up(size + offset, page);
+    size_t extra = (alignment > page) ? alignment - page : 0;   // Room to slide to an aligned start
+    unsigned char *base = mmap(NULL, len + extra, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (extra != 0) {
+        unsigned char *start = (unsigned char *) round_up((uintptr_t) base + page, alignment) - page;
+
+        if (start != base) {
+            munmap(base, start - base);
+        }
+        if (start + len != base + len + extra) {
+            munmap(start + len, base + extra - start);
+        }
+        base = start;
+    }
+
+    block_t *block = (block_t *) (base + offset - wsize);
+    block->header = pack(len, true, true) | mmapped_mask;
+
+    __atomic_fetch_add(&mmap_bytes, len, __ATOMIC_RELAXED);
+
+    return block;
+}
+
+/*
+ * mmap_base - Returns the start of the mapping holding a mapped block.
+ */
+static unsigned char *mmap_base(block_t *block)
+{
+    return (unsigned char *) ((uintptr_t) block & ~(uintptr_t) (mem_pagesize() - 1));
+}
+
+/*
+ * mmap_free - Unmap a block made by mmap_alloc.
+ */
+static void mmap_free(block_t *block)
+{
+    size_t len = get_size(block);
+
+    munmap(mmap_base(block), len);
+    __atomic_fetch_sub(&mmap_bytes, len, __ATOMIC_RELAXED);
+}
+
+/*
+ * mmap_realloc - Resize a mapped block. While size stays at or above
+ *                mmap_threshold the mapping itself is resized with mremap,
+ *                which may move it but never copies the payload; smaller
+ *                sizes, or a failed mremap, move the payload to a new block.
+ */
+static void *mmap_realloc(block_t *block, size_t size)
+{
+    unsigned char *base = mmap_base(block);
+    size_t offset = (unsigned char *) header_to_payload(block) - base;
+    size_t len = get_size(block);
+    size_t usable = len - offset;
+
+    if (size >= mmap_threshold) {
+        size_t new_len = round_up(size + offset, mem_pagesize());
+
+        if (new_len == len) {
+            return header_to_payload(block);
+        }
+
+        unsigned char *new_base = mremap(base, len, new_len, MREMAP_MAYMOVE);
+
+        if (new_base != MAP_FAILED) {
+            __atomic_fetch_add(&mmap_bytes, new_len - len, __ATOMIC_RELAXED);     // Wraps when shrinking
+            block = (block_t *) (new_base + offset - wsize);
+            block->header = pack(new_len, true, true) | mmapped_mask;
+            return header_to_payload(block);
+        }
+
+        if (new_len < len) {        // Could not shrink; the payload still fits
+            return header_to_payload(block);
+        }
+    }
+
+    void *newptr = malloc_payload(size);
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    memcpy(newptr, header_to_payload(block), (size < usable) ? size : usable);
+    mmap_free(block);
+
+    return newptr;
+}
+
+/*
+ * slab_owns - Returns whether p points into the slab reservation, i.e. is
+ *             a slab slot rather than a heap block's payload.
+ */
+static bool slab_owns(const void *p)
+{
+    unsigned char *base = __atomic_load_n(&slab_base, __ATOMIC_ACQUIRE);
+
+    return base != NULL && (size_t) ((const unsigned char *) p - base) < slab_span;
+}
+
+/*
+ * slab_run_of - Returns the run holding slot p.
+ */
+static slab_run_t *slab_run_of(const void *p)
+{
+    return (slab_run_t *) ((uintptr_t) p & ~(uintptr_t) (slab_run_size - 1));
+}
+
+/*
+ * slab_first_slot - Offset of slot 0 from the start of a run
+ */
+static size_t slab_first_slot(void)
+{
+    return round_up(sizeof(slab_run_t), dsize);
+}
+
+/*
+ * slab_new_run - Get an empty run for class cls in arena: the arena's
+ *                spare, a released run, or a run carved from the slab
+ *                reservation (reserved on first use). Returns NULL once the
+ *                reservation is exhausted. Caller holds the arena lock.
+ */
+static slab_run_t *slab_new_run(arena_t *arena, size_t cls)
+{
+    slab_run_t *run = arena->slab_spare;
+    size_t slot_size = (cls + 1) * dsize;
+    size_t nslots = (slab_run_size - slab_first_slot()) / slot_size;
+    size_t untouched = nslots;      // A spare run has been written all over
+
+    if (run != NULL) {
+        arena->slab_spare = NULL;
+    } else if ((run = arena->slab_dirty) != NULL) {
+        arena->slab_dirty = run->next;      // Still resident, so not zero either
+    } else {
+#ifdef MM_THREAD_SAFE
+        pthread_mutex_lock(&slab_mutex);
+#endif
+        if (slab_base == NULL) {
+            void *base = mmap(NULL, slab_span, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base != MAP_FAILED) {
+                slab_brk = base;
+                __atomic_store_n(&slab_base, (unsigned char *) base, __ATOMIC_RELEASE);
+            }
+        }
+
+        if ((run = slab_free_runs) != NULL) {
+            slab_free_runs = run->next;
+            slab_released -= slab_run_size;
+        } else if (slab_base != NULL && slab_brk < slab_base + slab_span) {
+            run = (slab_run_t *) slab_brk;
+            slab_brk += slab_run_size;
+        }
+#ifdef MM_THREAD_SAFE
+        pthread_mutex_unlock(&slab_mutex);
+#endif
+        if (run == NULL) {
+            return NULL;
+        }
+
+        untouched = 0;      // Released and new runs read as zero
+    }
+
+    run->arena = arena;
+    run->slot_size = slot_size;
+    run->cls = cls;
+    run->nslots = nslots;
+    run->nfree = nslots;
+    run->untouched = untouched;
+
+    for (size_t i = 0; i < 4; i++) {
+        size_t lo = 64 * i;
+        run->bitmap[i] = (nslots <= lo) ? 0 :
+                         (nslots >= lo + 64) ? ~(uint64_t) 0 :
+                         ((uint64_t) 1 << (nslots - lo)) - 1;
+    }
+
+    run->prev = NULL;
+    run->next = NULL;
+    arena->slab_partial[cls] = run;
+
+    return run;
+}
+
+/*
+ * slab_alloc - Hand out a free slot of class cls from arena, the lowest
+ *              free slot of the first partial run as found by a
+ *              find-first-set on its bitmap. *fresh tells whether the slot
+ *              was never handed out before. Caller holds the arena lock.
+ */
+static void *slab_alloc(arena_t *arena, size_t cls, bool *fresh)
+{
+    slab_run_t *run = arena->slab_partial[cls];
+
+    if (run == NULL && (run = slab_new_run(arena, cls)) == NULL) {
+        return NULL;
+    }
+
+    size_t word = 0;
+    while (run->bitmap[word] == 0) {
+        word++;
+    }
+
+    size_t idx = 64 * word + __builtin_ctzll(run->bitmap[word]);
+
+    run->bitmap[word] &= run->bitmap[word] - 1;
+    stats_slab(arena, run->slot_size, true);
+
+    if (--run->nfree == 0) {        // Full runs leave the partial list
+        arena->slab_partial[cls] = run->next;
+        if (run->next != NULL) {
+            run->next->prev = NULL;
+        }
+    }
+
+    *fresh = (idx >= run->untouched);
+    if (*fresh) {
+        run->untouched = idx + 1;
+    }
+
+    return (unsigned char *) run + slab_first_slot() + idx * run->slot_size;
+}
+
+/*
+ * slab_free - Return slot p to its run. A run that was full goes back on
+ *             the partial list; a run that becomes empty is kept as the
+ *             arena's spare or released to the OS. Caller holds the lock
+ *             of run->arena.
+ */
+static void slab_free(slab_run_t *run, void *p)
+{
+    arena_t *arena = run->arena;
+    size_t idx = ((unsigned char *) p - (unsigned char *) run - slab_first_slot()) / run->slot_size;
+
+    run->bitmap[idx / 64] |= (uint64_t) 1 << (idx % 64);
+    stats_slab(arena, run->slot_size, false);
+
+    if (run->nfree++ == 0) {
+        run->prev = NULL;
+        run->next = arena->slab_partial[run->cls];
+        if (run->next != NULL) {
+            run->next->prev = run;
+        }
+        arena->slab_partial[run->cls] = run;
+    }
+
+    if (run->nfree < run->nslots) {
+        return;
+    }
+
+    // Empty: unlink from the partial list
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        arena->slab_partial[run->cls] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+
+    if (arena->slab_spare == NULL) {
+        arena->slab_spare = run;
+        return;
+    }
+
+    // Released once it has stayed empty for decay_ms
+    run->freed_at = arena->purge_now;
+    run->next = arena->slab_dirty;
+    arena->slab_dirty = run;
+
+    purge_tick(arena);
+}
+
+/*
+ * slab_release - Give an empty run's pages back to the system and put it
+ *                on the shared list of released runs.
+ */
+static void slab_release(slab_run_t *run)
+{
+    madvise(run, slab_run_size, MADV_DONTNEED);
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_lock(&slab_mutex);
+#endif
+    run->next = slab_free_runs;
+    slab_free_runs = run;
+    slab_released += slab_run_size;
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_unlock(&slab_mutex);
+#endif
+}
+
+/*
+ * small_alloc - Returns a slab slot for a request of size <= slab_max
+ *               bytes, from the thread cache when there is one, or NULL if
+ *               no slab memory is left.
+ */
+static void *small_alloc(size_t size, bool *fresh)
+{
+    size_t cls = (size - 1) / dsize;
+
+#ifdef MM_THREAD_SAFE
+    void *slot = tcache_get_slot(cls);
+
+    *fresh = false;
+    if (slot != NULL) {
+        return slot;
+    }
+#endif
+
+    arena_t *arena = arena_self();
+
+    heap_lock(arena);
+    remote_drain(arena);
+    void *p = slab_alloc(arena, cls, fresh);
+    heap_unlock(arena);
+
+    return p;
+}
+
+/*
+ * small_free - Release slab slot p, into the thread cache when there is one.
+ */
+static void small_free(void *p)
+{
+    slab_run_t *run = slab_run_of(p);
+
+#ifdef MM_THREAD_SAFE
+    tcache_put_slot(p, run);
+#else
+    slab_free(run, p);
+#endif
+}
+
+/*
+ * stats_clock - Returns a cycle count for latency measurements: the time
+ *               stamp counter on x86, the virtual counter on AArch64 and
+ *               nanoseconds elsewhere. Always 0 without MM_STATS.
+ */
+static uint64_t stats_clock(void)
+{
+#if !defined(MM_STATS)
+    return 0;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return ticks;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#if defined(MM_STATS) && defined(MM_THREAD_SAFE)
+
+/*
+ * latency_release - pthread key destructor: folds an exiting thread's
+ *                   histograms into latency_retired and unlinks them.
+ */
+static void latency_release(void *arg)
+{
+    latency_t *lat = arg;
+
+    pthread_mutex_lock(&latency_mutex);
+
+    for (size_t i = 0; i < MM_STATS_BUCKETS; i++) {
+        latency_retired.malloc_cycles[i] += lat->malloc_cycles[i];
+        latency_retired.free_cycles[i] += lat->free_cycles[i];
+    }
+
+    if (lat->prev != NULL) {
+        lat->prev->next = lat->next;
+    } else {
+        latency_threads = lat->next;
+    }
+    if (lat->next != NULL) {
+        lat->next->prev = lat->prev;
+    }
+
+    pthread_mutex_unlock(&latency_mutex);
+}
+
+static void latency_key_create(void)
+{
+    pthread_key_create(&latency_key, latency_release);
+}
+
+/*
+ * latency_register - Link the calling thread's histograms on
+ *                    latency_threads the first time it records one.
+ */
+static void latency_register(void)
+{
+    pthread_once(&latency_key_once, latency_key_create);
+
+    pthread_mutex_lock(&latency_mutex);
+    thread_latency.prev = NULL;
+    thread_latency.next = latency_threads;
+    if (latency_threads != NULL) {
+        latency_threads->prev = &thread_latency;
+    }
+    latency_threads = &thread_latency;
+    pthread_mutex_unlock(&latency_mutex);
+
+    pthread_setspecific(latency_key, &thread_latency);
+    thread_latency.registered = true;
+}
+
+#endif
+
+/*
+ * stats_latency - Count one mm_malloc (or, if free_op, mm_free) call that
+ *                 began at stats_clock() time start in the calling
+ *                 thread's histogram. Bucket i holds calls that took
+ *                 [2^(i-1), 2^i) cycles; the last one holds all slower.
+ */
+static void stats_latency(bool free_op, uint64_t start)
+{
+#ifdef MM_STATS
+    uint64_t cycles = stats_clock() - start;
+    size_t bucket = (cycles == 0) ? 0 : 64 - __builtin_clzll(cycles);
+    uint64_t *hist = free_op ? thread_latency.free_cycles : thread_latency.malloc_cycles;
+
+    if (bucket >= MM_STATS_BUCKETS) {
+        bucket = MM_STATS_BUCKETS - 1;
+    }
+
+#ifdef MM_THREAD_SAFE
+    if (!thread_latency.registered) {
+        latency_register();
+    }
+    // Only this thread writes; mm_stats may read concurrently
+    __atomic_store_n(&hist[bucket], hist[bucket] + 1, __ATOMIC_RELAXED);
+#else
+    hist[bucket]++;
+#endif
+#else
+    (void) free_op;
+    (void) start;
+#endif
+}
+
+/*
+ * stats_listed - Account for a free block of size bytes entering (listed)
+ *                or leaving the free lists. Caller holds the arena lock,
+ *                as for all the arena counters below.
+ */
+static void stats_listed(arena_t *arena, size_t size, bool listed)
+{
+#ifdef MM_STATS
+    if (listed) {
+        arena->stats.free_blocks++;
+        arena->stats.free_bytes += size;
+    } else {
+        arena->stats.free_blocks--;
+        arena->stats.free_bytes -= size;
+    }
+#else
+    (void) arena;
+    (void) size;
+    (void) listed;
+#endif
+}
+
+/*
+ * stats_fit - Account for a find_fit call that looked at steps blocks.
+ */
+static void stats_fit(arena_t *arena, size_t steps)
+{
+#ifdef MM_STATS
+    arena->stats.fit_searches++;
+    arena->stats.fit_steps += steps;
+    if (steps > arena->stats.fit_max_steps) {
+        arena->stats.fit_max_steps = steps;
+    }
+#else
+    (void) arena;
+    (void) steps;
+#endif
+}
+
+/*
+ * stats_extend - Account for the heap growing by size bytes.
+ */
+static void stats_extend(arena_t *arena, size_t size)
+{
+#ifdef MM_STATS
+    arena->stats.extend_calls++;
+    arena->stats.extend_bytes += size;
+#else
+    (void) arena;
+    (void) size;
+#endif
+}
+
+/*
+ * stats_coalesce / stats_split - Account for one merge with a free
+ *                                neighbour, or one block split in two.
+ */
+static void stats_coalesce(arena_t *arena)
+{
+#ifdef MM_STATS
+    arena->stats.coalesces++;
+#else
+    (void) arena;
+#endif
+}
+
+static void stats_split(arena_t *arena)
+{
+#ifdef MM_STATS
+    arena->stats.splits++;
+#else
+    (void) arena;
+#endif
+}
+
+/*
+ * stats_purge - Count one madvise call made by purging.
+ */
+static void stats_purge(arena_t *arena)
+{
+#ifdef MM_STATS
+    arena->stats.purges++;
+#else
+    (void) arena;
+#endif
+}
+
+#ifdef MM_THREAD_SAFE
+/*
+ * stats_remote - Count n remotely freed blocks drained from the arena.
+ */
+static void stats_remote(arena_t *arena, size_t n)
+{
+#ifdef MM_STATS
+    arena->stats.remote_frees += n;
+#else
+    (void) arena;
+    (void) n;
+#endif
+}
+#endif
+
+/*
+ * stats_slab - Account for a slab slot of size bytes being handed out
+ *              (alloc) or returned.
+ */
+static void stats_slab(arena_t *arena, size_t size, bool alloc)
+{
+#ifdef MM_STATS
+    if (alloc) {
+        arena->stats.slab_bytes += size;
+    } else {
+        arena->stats.slab_bytes -= size;
+    }
+#else
+    (void) arena;
+    (void) size;
+    (void) alloc;
+#endif
+}
+
+/*
+ * prof_malloc - mm_malloc for a call whose countdown ran out. Restarts the
+ *               countdown and, if the profiler is on, samples the call:
+ *               the block comes from the heap even if it is small, as
+ *               slab slots have no header to mark, and the caller's stack
+ *               is recorded against it.
+ */
+static void *prof_malloc(size_t size)
+{
+    prof_thread.countdown = prof_interval();
+
+    if (prof_period == 0 || prof_thread.busy || size == 0 || size > max_request) {
+        return malloc_payload(size);
+    }
+
+    void *pc[PROF_DEPTH + 1];
+
+    prof_thread.busy = true;
+
+    int depth = backtrace(pc, PROF_DEPTH + 1);     // May allocate the first time
+    void *ptr = heap_payload(size);
+
+    if (ptr != NULL && depth > 1) {
+        prof_record(ptr, size, pc + 1, depth - 1);      // Leave out prof_malloc itself
+    }
+
+    prof_thread.busy = false;
+
+    return ptr;
+}
+
+/*
+ * prof_interval - Returns the bytes until the calling thread's next
+ *                 sample: -ln(u) * prof_period for u uniform in (0, 1],
+ *                 with a rough log2 (within 0.01) that needs no libm.
+ *                 prof_idle while the profiler is off.
+ */
+static int64_t prof_interval(void)
+{
+    if (prof_period == 0) {
+        return prof_idle;
+    }
+
+    uint64_t x = prof_thread.rng;
+
+    if (x == 0) {
+        x = (uint64_t) (uintptr_t) &prof_thread * 0x9E3779B97F4A7C15u | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    prof_thread.rng = x;
+
+    union { double d; uint64_t bits; } u = { .d = (double) ((x >> 11) + 1) / 9007199254740992.0 };
+    int e = (int) ((u.bits >> 52) & 0x7ff) - 1023;
+
+    u.bits = (u.bits & ~((uint64_t) 0x7ff << 52)) | ((uint64_t) 1023 << 52);    // Mantissa in [1, 2)
+
+    double log2u = e + (2.0 - u.d / 3.0) * u.d - 5.0 / 3.0;
+
+    return (int64_t) (-log2u * 0.6931471805599453 * (double) prof_period) + 1;
+}
+
+/*
+ * prof_slot - Returns where a live sampled block's entry belongs in
+ *             prof_lives.
+ */
+static size_t prof_slot(uintptr_t ptr)
+{
+    return (size_t) (((ptr >> 4) * 0x9E3779B97F4A7C15u) >> (64 - __builtin_ctz(PROF_LIVE)));
+}
+
+/*
+ * prof_record - Count a sampled block of size requested bytes against the
+ *               stack of depth return addresses in pc, and mark the block
+ *               so that freeing it calls prof_forget. A sample that finds
+ *               either table full is dropped.
+ */
+static void prof_record(void *ptr, size_t size, void **pc, int depth)
+{
+    uint64_t hash = 14695981039346656037u;     // FNV-1a over the addresses
 
-          combined_block += get_size(next_block);
+    for (int d = 0; d < depth; d++) {
+        hash = (hash ^ (uintptr_t) pc[d]) * 1099511628211u;
+    }
+    hash |= 1;          // 0 marks an unused entry
+
+    prof_lock();
+
+    if (prof_stacks == NULL) {
+        void *stacks = mmap(NULL, PROF_STACKS * sizeof(prof_stack_t), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        void *lives = mmap(NULL, PROF_LIVE * sizeof(prof_live_t), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (stacks == MAP_FAILED || lives == MAP_FAILED) {
+            if (stacks != MAP_FAILED) {
+                munmap(stacks, PROF_STACKS * sizeof(prof_stack_t));
+            }
+            if (lives != MAP_FAILED) {
+                munmap(lives, PROF_LIVE * sizeof(prof_live_t));
+            }
+            prof_unlock();
+            return;
+        }
+        prof_stacks = stacks;
+        prof_lives = lives;
+    }
 
-           write_header(block, combined_block, 0);
-           write_footer(block, combined_block, 0);
-          
-           remove_block(next_block); //Ok so I need this here since now the next_block is combined with block, so it ain't really there.
+    if (prof_live_count >= PROF_LIVE / 4 * 3) {     // Keep the probes short
+        prof_unlock();
+        return;
+    }
 
-      }
-     
-      if(extract_alloc(*find_prev_footer(block)) == 0)     //If the previous block is also free
-      {
+    size_t i = hash & (PROF_STACKS - 1);
+    size_t probes = 0;
+    prof_stack_t *st;
 
-           
+    for (;;) {
+        st = &prof_stacks[i];
 
-          combined_block += get_size(prev_block);
+        if (st->hash == 0) {
+            st->hash = hash;
+            st->depth = (uint32_t) depth;
+            memcpy(st->pc, pc, depth * sizeof(*pc));
+            break;
+        }
+        if (st->hash == hash && st->depth == (uint32_t) depth &&
+            memcmp(st->pc, pc, depth * sizeof(*pc)) == 0) {
+            break;
+        }
+        if (++probes == PROF_STACKS) {
+            prof_unlock();
+            return;
+        }
+        i = (i + 1) & (PROF_STACKS - 1);
+    }
 
-          write_header(prev_block, combined_block, 0); 
-          write_footer(prev_block, combined_block, 0);  
+    st->live_count++;
+    st->live_bytes += size;
+    st->total_count++;
+    st->total_bytes += size;
 
-          remove_block(block);  //Same idea with this one. Combine prev block and the current block, now current block is just a part of prev block
+    size_t slot = prof_slot((uintptr_t) ptr);
 
+    while (prof_lives[slot].ptr != 0) {
+        slot = (slot + 1) & (PROF_LIVE - 1);
+    }
+    prof_lives[slot] = (prof_live_t) { (uintptr_t) ptr, size, (uint32_t) (st - prof_stacks) };
+    prof_live_count++;
 
-           block = prev_block;      //This is needed for if there are three in a row that are free
-      }
+    prof_unlock();
 
-     
-                   
-    return block;
+    prof_mark(ptr, true);
 }
 
 /*
- * See if new block can be split one to satisfy allocation
- * and one to keep free
+ * prof_forget - Drop the record of a sampled block that is being freed or
+ *               resized, and unmark it.
  */
-static void split_block(block_t *block, size_t asize)
+static void prof_forget(void *ptr)
 {
-    
-	if((get_size(block) - asize) >= min_block_size)          //If the block has enough leftover to be more than the minimum size
-    {
-        size_t *next_block_size = get_size(block) - asize;
-
-        write_header(block, asize, 1);                       //rewrite the header and footer to only use the space needed
-        write_footer(block, asize, 1);                      
-                                                            
-        //remove_block(block);  //Now I do this in malloc so don't need it here
+    prof_mark(ptr, false);
 
-        write_header(find_next(block), next_block_size, 0); //write headers and footers for the new free part
-        write_footer(find_next(block), next_block_size, 0);
+    prof_lock();
 
-        insert_block(find_next(block));
+    size_t mask = PROF_LIVE - 1;
+    size_t hole = prof_slot((uintptr_t) ptr);
 
-        //Would call insert here, but since I do it in coalesce I don't need to here
+    while (prof_lives != NULL && prof_lives[hole].ptr != (uintptr_t) ptr) {
+        if (prof_lives[hole].ptr == 0) {        // Recorded before the last prof_reset
+            prof_unlock();
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
 
-       coalesce_block(find_next(block));
+    if (prof_lives == NULL) {
+        prof_unlock();
+        return;
     }
 
-  // remove_block(block); //Coalesce has the remove stuff I need so don't need this here
+    prof_stack_t *st = &prof_stacks[prof_lives[hole].stack];
 
-    return;
+    st->live_count--;
+    st->live_bytes -= prof_lives[hole].size;
+    prof_live_count--;
 
-}
+    // Close the gap: move up each later entry of the run that the hole
+    // lies between its home slot and where it sits
+    for (size_t j = (hole + 1) & mask; prof_lives[j].ptr != 0; j = (j + 1) & mask) {
+        size_t home = prof_slot(prof_lives[j].ptr);
 
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            prof_lives[hole] = prof_lives[j];
+            hole = j;
+        }
+    }
+    prof_lives[hole].ptr = 0;
+
+    prof_unlock();
+}
 
 /*
- * Extends the heap with the requested number of bytes, and recreates end header. 
- * Returns a pointer to the result of coalescing the newly-created block with previous free block, 
- * if applicable, or NULL in failure.
+ * prof_mark - Set or clear the sampled bit of the block at ptr. A heap
+ *             block's header is shared with its neighbours' frees, so
+ *             that takes the heap lock; a mapped block's is only ours.
  */
-static block_t *extend_heap(size_t size) 
+static void prof_mark(void *ptr, bool sampled)
 {
-    void *bp;
+    block_t *block = payload_to_header(ptr);
+    arena_t *arena = extract_mmapped(read_header(block)) ? NULL : arena_of(block);
 
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk(size)) == (void *)-1) {
-        return NULL;
+    if (arena != NULL) {
+        heap_lock(arena);
     }
 
-    // bp is a pointer to the new memory block requested
-     
-    // TODO: Implement extend_heap.
-   
-
-    bp = find_prev_footer(bp);  //old epilogue header is this blocks header
-
-    block_t *bp_next;
+    word_t header = block->header;
 
-    write_header( bp, size, 0);  //This write the header. alloc is 0 since this is free right?
-    write_footer( bp, size, 0);
+    if (sampled) {
+        header |= sampled_mask;
+    } else {
+        header &= ~sampled_mask;
+    }
+    __atomic_store_n(&block->header, header, __ATOMIC_RELAXED);
 
-    insert_block(bp);
+    if (arena != NULL) {
+        heap_unlock(arena);
+    }
+}
 
+/*
+ * prof_reset - Forget every sample, for mm_init.
+ */
+static void prof_reset(void)
+{
+    prof_lock();
 
-    bp_next = find_next(bp);
-     
+    if (prof_stacks != NULL) {
+        madvise(prof_stacks, PROF_STACKS * sizeof(prof_stack_t), MADV_DONTNEED);
+        madvise(prof_lives, PROF_LIVE * sizeof(prof_live_t), MADV_DONTNEED);
+    }
+    prof_live_count = 0;
 
-    write_header( bp_next, 0, 1);
+    prof_unlock();
+}
 
-  
+static void prof_lock(void)
+{
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_lock(&prof_mutex);
+#endif
+}
 
-    return coalesce_block(bp); 
+static void prof_unlock(void)
+{
+#ifdef MM_THREAD_SAFE
+    pthread_mutex_unlock(&prof_mutex);
+#endif
+}
 
+/*
+ * prof_write - printf to a file descriptor, through a buffer on the
+ *              stack, since stdio would allocate. Returns whether all of
+ *              it was written.
+ */
+static bool prof_write(int fd, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
 
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
 
-  
-   
+    if (len < 0 || (size_t) len >= sizeof(buf)) {
+        return false;
+    }
+    return write(fd, buf, len) == len;
 }
 
 /******** The remaining content below are helper and debug routines ********/
@@ -532,26 +4811,32 @@ static int in_heap(const void* p)
 /*
  * examine_heap -- Print the heap by iterating through it as an implicit free list. 
  */
-static void examine_heap() {
+static void examine_heap(arena_t *arena) {
   block_t *block;
 
   /* print to stderr so output isn't buffered and not output if we crash */
-  fprintf(stderr, "free_list_head: %p\n", (void *)free_list_head);
+  fprintf(stderr, "seg_bitmap: 0x%016" PRIx64 "\n", arena->seg_bitmap);
 
-  for (block = heap_start; /* first block on heap */
+  for (block = arena->heap_start; /* first block on heap */
       get_size(block) > 0 && block < (block_t*)mem_heap_hi();
       block = find_next(block)) {
 
     /* print out common block attributes */
-    fprintf(stderr, "%p: %ld %d\t", (void *)block, get_size(block), get_alloc(block));
+    fprintf(stderr, "%p: %ld %d (prev %d)\t", (void *)block, get_size(block),
+            get_alloc(block), get_prev_alloc(block));
 
     /* and allocated/free specific data */
     if (get_alloc(block)) {
       fprintf(stderr, "ALLOCATED\n");
+    } else if (get_size(block) >= tree_min) {
+      fprintf(stderr, "FREE\tparent: %p, left: %p, right: %p\n",
+      (void *)block->payload.node.parent,
+      (void *)block->payload.node.child[0],
+      (void *)block->payload.node.child[1]);
     } else {
       fprintf(stderr, "FREE\tnext: %p, prev: %p\n",
-      (void *)block->payload.links.next,
-      (void *)block->payload.links.prev);
+      (void *)link_block(arena, block->payload.links.next),
+      (void *)link_block(arena, block->payload.links.prev));
     }
   }
   fprintf(stderr, "END OF HEAP\n\n");
@@ -561,41 +4846,213 @@ static void examine_heap() {
 /* check_heap: checks the heap for correctness; returns true if
  *               the heap is correct, and false otherwise.
  */
-static bool check_heap()
+static bool check_heap(arena_t *arena)
 {
 
     // Implement a heap consistency checker as needed.
 
     /* Below is an example, but you will need to write the heap checker yourself. */
 
-    if (!heap_start) {
+    if (!arena->heap_start) {
         printf("NULL heap list pointer!\n");
         return false;
     }
 
-    block_t *curr = heap_start;
-    block_t *next;
-    block_t *hi = mem_heap_hi();
+    block_t *curr = arena->heap_start;
+    bool prev_alloc = true;     // the prologue counts as allocated
+    size_t prev_size = 0;
+    size_t tree_blocks = 0;
+    size_t purged_pages = 0;
 
-    while ((next = find_next(curr)) + 1 < hi) {
+    for (; get_size(curr) != 0; curr = find_next(curr)) {
         word_t hdr = curr->header;
-        word_t ftr = *find_prev_footer(next);
 
-        if (hdr != ftr) {
-            printf(
-                    "Header (0x%016lX) != footer (0x%016lX)\n",
-                    hdr, ftr
-                  );
+        if (extract_prev_alloc(hdr) != prev_alloc) {
+            printf("Block %p has a stale prev_alloc bit\n", (void *) curr);
+            return false;
+        }
+        if (!prev_alloc && extract_prev_mini(hdr) != (prev_size == min_block_size)) {
+            printf("Block %p has a stale prev_mini bit\n", (void *) curr);
+            return false;
+        }
+
+        if (!extract_alloc(hdr) && extract_size(hdr) > min_block_size) {
+            word_t ftr = *header_to_footer(curr);
+
+            if (extract_size(hdr) != extract_size(ftr)) {
+                printf(
+                        "Header (0x%016lX) != footer (0x%016lX)\n",
+                        hdr, ftr
+                      );
+                return false;
+            }
+        }
+        if (!extract_alloc(hdr)) {
+            if (!prev_alloc) {
+                printf("Adjacent free blocks at %p\n", (void *) curr);
+                return false;
+            }
+            if (extract_size(hdr) >= tree_min) {
+                tree_blocks++;
+                purged_pages += curr->payload.node.purged;
+            }
+        }
+
+        prev_alloc = extract_alloc(hdr);
+        prev_size = extract_size(hdr);
+    }
+
+    if (extract_prev_alloc(curr->header) != prev_alloc ||
+        (!prev_alloc && extract_prev_mini(curr->header) != (prev_size == min_block_size))) {
+        printf("Epilogue has a stale prev_alloc or prev_mini bit\n");
+        return false;
+    }
+
+    /* Every listed block must be free, filed under its own class, and
+     * seg_bitmap must mirror which lists are non-empty */
+    for (size_t i = 0; i < SEG_CLASSES; i++) {
+        bool nonempty = (arena->seg_bitmap >> i) & 1;
+
+        if (nonempty != (arena->seg_lists[i] != NULL)) {
+            printf("seg_bitmap bit %zu disagrees with list\n", i);
+            return false;
+        }
+
+        block_t *prev = NULL;
+        for (block_t *b = arena->seg_lists[i]; b != NULL;
+             b = link_block(arena, b->payload.links.next)) {
+            if ((arena == &main_arena && !in_heap(b)) ||
+                get_alloc(b) || size_class(get_size(b)) != i) {
+                printf("Block %p misfiled in class %zu\n", (void *) b, i);
+                return false;
+            }
+            if (link_block(arena, b->payload.links.prev) != prev) {
+                printf("Broken prev link at %p\n", (void *) b);
+                return false;
+            }
+            if (arena->placement == MM_PLACE_ADDRESS && prev != NULL && b < prev) {
+                printf("Block %p out of address order in class %zu\n", (void *) b, i);
+                return false;
+            }
+            prev = b;
+        }
+
+        if (arena->seg_tails[i] != prev) {
+            printf("Stale tail of class %zu\n", i);
             return false;
         }
 
-        curr = next;
+        /* Express lanes must be ordered, doubly linked and hold only
+         * blocks that belong on them */
+        for (int lane = 1; arena->placement == MM_PLACE_ADDRESS && lane < SKIP_LEVELS; lane++) {
+            prev = NULL;
+            for (block_t *b = *lane_head(arena, i, lane); b != NULL; b = lane_next(arena, b, lane)) {
+                if (get_alloc(b) || size_class(get_size(b)) != i || skip_levels(b) <= lane ||
+                    link_block(arena, b->payload.lanes[lane].prev) != prev ||
+                    (prev != NULL && b < prev)) {
+                    printf("Block %p misplaced on lane %d of class %zu\n", (void *) b, lane, i);
+                    return false;
+                }
+                prev = b;
+            }
+        }
+    }
+
+    /* Quick-listed blocks stay allocated and have their bin's size */
+    for (size_t bin = 0; bin < QUICK_BINS; bin++) {
+        for (block_t *b = arena->quick[bin]; b != NULL; b = b->payload.chain) {
+            if (!get_alloc(b) || quick_bin(get_size(b)) != bin || get_size(b) > quick_max) {
+                printf("Block %p misfiled in quick list %zu\n", (void *) b, bin);
+                return false;
+            }
+        }
+    }
+
+    /* The tree must hold exactly the large free blocks */
+    size_t tree_count = 0;
+
+    if (check_tree(arena->tree_root, NULL, &tree_count) < 0) {
+        return false;
+    }
+    if (tree_count != tree_blocks) {
+        printf("Tree holds %zu blocks, heap has %zu large free blocks\n",
+               tree_count, tree_blocks);
+        return false;
+    }
+    if (purged_pages * mem_pagesize() != arena->purged_bytes) {
+        printf("Free blocks hold %zu purged pages, arena counts %zu bytes\n",
+               purged_pages, arena->purged_bytes);
+        return false;
+    }
+
+    /* Partial runs must belong here, hold their class and have as many
+     * set bitmap bits as free slots */
+    for (size_t cls = 0; cls < SLAB_CLASSES; cls++) {
+        for (slab_run_t *run = arena->slab_partial[cls]; run != NULL; run = run->next) {
+            size_t free_bits = 0;
+
+            for (size_t i = 0; i < 4; i++) {
+                free_bits += __builtin_popcountll(run->bitmap[i]);
+            }
+            if (run->arena != arena || run->cls != cls ||
+                run->nfree == 0 || free_bits != run->nfree) {
+                printf("Slab run %p is inconsistent\n", (void *) run);
+                return false;
+            }
+        }
     }
 
     return true;
 }
 
 
+/*
+ * check_tree: checks the subtree at node (links, key order, red-black
+ *             rules, only free large blocks) and adds its size to *count.
+ *             Returns the subtree's black height, or -1 if it is broken.
+ */
+static int check_tree(block_t *node, block_t *parent, size_t *count)
+{
+    if (node == NULL) {
+        return 0;
+    }
+
+    if (node->payload.node.parent != parent || get_alloc(node) ||
+        get_size(node) < tree_min) {
+        printf("Tree node %p is misplaced\n", (void *) node);
+        return -1;
+    }
+    if (tree_is_red(node) && tree_is_red(parent)) {
+        printf("Red tree node %p has a red parent\n", (void *) node);
+        return -1;
+    }
+
+    for (int dir = 0; dir < 2; dir++) {
+        block_t *child = node->payload.node.child[dir];
+
+        if (child != NULL &&
+            ((get_size(child) > get_size(node) ||
+              (get_size(child) == get_size(node) && child > node)) != dir)) {
+            printf("Tree node %p is out of order\n", (void *) child);
+            return -1;
+        }
+    }
+
+    int left = check_tree(node->payload.node.child[0], node, count);
+    int right = check_tree(node->payload.node.child[1], node, count);
+
+    if (left < 0 || right < 0 || left != right) {
+        if (left >= 0 && right >= 0) {
+            printf("Unequal black heights below %p\n", (void *) node);
+        }
+        return -1;
+    }
+
+    (*count)++;
+    return left + !tree_is_red(node);
+}
+
+
 /*
  *****************************************************************************
  * The functions below are short wrapper functions to perform                *
@@ -611,6 +5068,14 @@ static size_t max(size_t x, size_t y)
     return (x > y) ? x : y;
 }
 
+/*
+ * min: returns x if x < y, and y otherwise.
+ */
+static size_t min(size_t x, size_t y)
+{
+    return (x < y) ? x : y;
+}
+
 
 /*
  * round_up: Rounds size up to next multiple of n
@@ -621,13 +5086,52 @@ static size_t round_up(size_t size, size_t n)
 }
 
 
+/*
+ * size_class: maps a block size to its segregated list index. Sizes under
+ *             seg_exact_limit map to size / 16; larger sizes use two
+ *             classes per power of two, selected by the bit below the MSB.
+ */
+static size_t size_class(size_t size)
+{
+    if (size < seg_exact_limit) {
+        return size >> 4;
+    }
+
+    size_t msb = 63 - __builtin_clzll(size);
+    size_t base = __builtin_ctzll(seg_exact_limit);
+    size_t idx = (seg_exact_limit >> 4) + 2 * (msb - base) + ((size >> (msb - 1)) & 1);
+
+    return (idx < SEG_CLASSES) ? idx : SEG_CLASSES - 1;
+}
+
+
+/*
+ * adjust_size: returns the block size needed for a request of size bytes.
+ *              Rounds up to the 16-byte alignment; allocated blocks have no
+ *              footer, so only the header is added.
+ */
+static size_t adjust_size(size_t size)
+{
+    return max(round_up(size + wsize, dsize), min_block_size);
+}
+
+
 /*
  * pack: returns a header reflecting a specified size and its alloc status.
  *       If the block is allocated, the lowest bit is set to 1, and 0 otherwise.
+ *       The second bit likewise records whether the previous block is allocated.
  */
-static word_t pack(size_t size, bool alloc)
+static word_t pack(size_t size, bool alloc, bool prev_alloc)
 {
-    return alloc ? (size | alloc_mask) : size;
+    word_t word = size;
+
+    if (alloc) {
+        word |= alloc_mask;
+    }
+    if (prev_alloc) {
+        word |= prev_alloc_mask;
+    }
+    return word;
 }
 
 
@@ -672,24 +5176,191 @@ static bool get_alloc(block_t *block)
 
 
 /*
- * write_header: given a block and its size and allocation status,
- *               writes an appropriate value to the block header.
+ * extract_mmapped: returns whether a given header value belongs to a block
+ *                  with a mapping of its own (see mmapped_mask).
+ */
+static bool extract_mmapped(word_t word)
+{
+    return (bool) (word & mmapped_mask);
+}
+
+
+/*
+ * extract_sampled: returns whether a given header value belongs to a block
+ *                  the heap profiler sampled (see sampled_mask).
+ */
+static bool extract_sampled(word_t word)
+{
+    return (bool) (word & sampled_mask);
+}
+
+
+/*
+ * extract_prev_alloc: returns the allocation status of the previous block
+ *                     as recorded in a given header value.
+ */
+static bool extract_prev_alloc(word_t word)
+{
+    return (bool) (word & prev_alloc_mask);
+}
+
+
+/*
+ * get_prev_alloc: returns true when the block before this one is allocated
+ *                 based on the block header's second bit, and false otherwise.
+ */
+static bool get_prev_alloc(block_t *block)
+{
+    return extract_prev_alloc(block->header);
+}
+
+
+/*
+ * write_header: given a block and its size and allocation status, and the
+ *               allocation status of its predecessor, writes an appropriate
+ *               value to the block header.
+ */
+static void write_header(block_t *block, size_t size, bool alloc, bool prev_alloc)
+{
+    word_t word = pack(size, alloc, prev_alloc);
+
+    if (!prev_alloc) {
+        word |= block->header & prev_mini_mask;     // Still needed to find the free block before
+    }
+    block->header = word;
+}
+
+
+/*
+ * write_footer: given a free block and its size, writes the size to the
+ *               block footer by first computing the position of the footer,
+ *               and tells the next block (whose header must be in place)
+ *               whether this is a mini block, which has no footer.
+ *               Allocated blocks have no footer.
+ */
+static void write_footer(block_t *block, size_t size)
+{
+    block_t *next = (block_t *) ((unsigned char *) block + size);
+
+    if (size > min_block_size) {
+        *find_prev_footer(next) = pack(size, false, false);
+    }
+    write_prev_mini(next, size == min_block_size);
+}
+
+
+/*
+ * write_prev_alloc: updates the prev_alloc bit in a block's header after
+ *                   the block before it changed allocation status. The
+ *                   block may be allocated and being read by its owner
+ *                   without the heap lock, hence the atomic store.
+ */
+static void write_prev_alloc(block_t *block, bool prev_alloc)
+{
+    word_t header = block->header;
+
+    if (prev_alloc) {
+        header |= prev_alloc_mask;
+    } else {
+        header &= ~prev_alloc_mask;
+    }
+    __atomic_store_n(&block->header, header, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * write_prev_mini: updates the prev_mini bit in a block's header. Like
+ *                  write_prev_alloc, the block may be allocated and read
+ *                  by its owner without the heap lock.
+ */
+static void write_prev_mini(block_t *block, bool prev_mini)
+{
+    word_t header = block->header;
+
+    if (prev_mini) {
+        header |= prev_mini_mask;
+    } else {
+        header &= ~prev_mini_mask;
+    }
+    __atomic_store_n(&block->header, header, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * extract_prev_mini: returns whether a given header value says the block
+ *                    before it is a free mini block.
+ */
+static bool extract_prev_mini(word_t word)
+{
+    return (bool) (word & prev_mini_mask);
+}
+
+
+/*
+ * read_header: returns a block's header for code running without the heap
+ *              lock (the owner of an allocated block). Only the prev_alloc
+ *              bit can change underneath it, via write_prev_alloc.
+ */
+static word_t read_header(block_t *block)
+{
+    return __atomic_load_n(&block->header, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * get_fresh: returns true when the block is marked fresh (see fresh_mask).
  */
-static void write_header(block_t *block, size_t size, bool alloc)
+static bool get_fresh(block_t *block)
 {
-    block->header = pack(size, alloc);
+    return (bool) (block->header & fresh_mask);
 }
 
 
 /*
- * write_footer: given a block and its size and allocation status,
- *               writes an appropriate value to the block footer by first
- *               computing the position of the footer.
+ * write_fresh: sets or clears the fresh bit in a block's header.
+ *              write_header always clears it.
  */
-static void write_footer(block_t *block, size_t size, bool alloc)
+static void write_fresh(block_t *block, bool fresh)
 {
-    word_t *footerp = header_to_footer(block);
-    *footerp = pack(size, alloc);
+    if (fresh) {
+        block->header |= fresh_mask;
+    } else {
+        block->header &= ~fresh_mask;
+    }
+}
+
+
+/*
+ * zero_words: clears size bytes starting at the 8-byte aligned pointer p.
+ *             The body is cleared 64 bytes per iteration with 16-byte
+ *             vector stores (the compiler emits SSE/NEON for these);
+ *             very large ranges are left to memset, which switches to
+ *             non-temporal stores.
+ */
+static void zero_words(void *p, size_t size)
+{
+    typedef word_t vec_t __attribute__((vector_size(16), aligned(8)));
+    unsigned char *cur = p;
+    unsigned char *end = cur + size;
+
+    if (size >= (1 << 16)) {
+        memset(p, 0, size);
+        return;
+    }
+
+    for (; cur + 4 * sizeof(vec_t) <= end; cur += 4 * sizeof(vec_t)) {
+        vec_t *v = (vec_t *) cur;
+        v[0] = (vec_t) {0, 0};
+        v[1] = (vec_t) {0, 0};
+        v[2] = (vec_t) {0, 0};
+        v[3] = (vec_t) {0, 0};
+    }
+    for (; cur + sizeof(word_t) <= end; cur += sizeof(word_t)) {
+        *(word_t *) cur = 0;
+    }
+    for (; cur < end; cur++) {
+        *cur = 0;
+    }
 }
 
 
@@ -704,7 +5375,8 @@ static block_t *find_next(block_t *block)
 
 
 /*
- * find_prev_footer: returns the footer of the previous block.
+ * find_prev_footer: returns the footer of the previous block (meaningful
+ *                   only if that block is free).
  */
 static word_t *find_prev_footer(block_t *block)
 {
@@ -715,11 +5387,16 @@ static word_t *find_prev_footer(block_t *block)
 
 /*
  * find_prev: returns the previous block position by checking the previous
- *            block's footer and calculating the start of the previous block
- *            based on its size.
+ *            block's footer (or prev_mini bit) and calculating the start of
+ *            the previous block based on its size. Only valid when the previous block is free,
+ *            i.e. when get_prev_alloc(block) is false.
  */
 static block_t *find_prev(block_t *block)
 {
+    if (extract_prev_mini(block->header)) {
+        return (block_t *) ((unsigned char *) block - min_block_size);
+    }
+
     word_t *footerp = find_prev_footer(block);
     size_t size = extract_size(*footerp);
     return (block_t *) ((unsigned char *) block - size);
@@ -754,3 +5431,31 @@ static word_t *header_to_footer(block_t *block)
 {
     return (word_t *) (block->payload.data + get_size(block) - dsize);
 }
+
+
+/*
+ * block_link: returns the free-list link for a block of the arena: its
+ *             distance from the heap start in 16-byte units, plus one so
+ *             that 0 stands for NULL. Heaps stay under link_span bytes,
+ *             so the link fits in 32 bits.
+ */
+static uint32_t block_link(arena_t *arena, block_t *block)
+{
+    if (block == NULL) {
+        return 0;
+    }
+    return (uint32_t) (((unsigned char *) block - (unsigned char *) arena->heap_start) / dsize + 1);
+}
+
+
+/*
+ * link_block: returns the block a free-list link of the arena refers to,
+ *             or NULL for link 0.
+ */
+static block_t *link_block(arena_t *arena, uint32_t link)
+{
+    if (link == 0) {
+        return NULL;
+    }
+    return (block_t *) ((unsigned char *) arena->heap_start + (size_t) (link - 1) * dsize);
+}
@@ -0,0 +1,126 @@
+#ifndef MM_H
+#define MM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int mm_init(void);
+void *mm_malloc(size_t size);
+void mm_free(void *ptr);
+void *mm_realloc(void *ptr, size_t size);
+void *mm_calloc(size_t nmemb, size_t size);
+
+/* Free a block whose requested size (and alignment) the caller knows */
+void mm_free_sized(void *ptr, size_t size);
+void mm_free_aligned_sized(void *ptr, size_t alignment, size_t size);
+
+/* Allocations aligned to a power of two beyond the usual 16 bytes */
+void *mm_memalign(size_t alignment, size_t size);
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/*
+ * Allocate n blocks of size bytes into ptrs; returns how many it got.
+ * Free n blocks (NULL allowed), reordering ptrs by address on the way.
+ */
+size_t mm_malloc_batch(size_t n, size_t size, void **ptrs);
+void mm_free_batch(size_t n, void **ptrs);
+
+/*
+ * Regions: bump allocation from a few big blocks, all freed at once by
+ * reset or destroy, or back to a mark by rollback. One thread at a time.
+ */
+typedef struct mm_region mm_region_t;
+typedef struct { void *chunk; void *top; } mm_region_mark_t;
+
+mm_region_t *mm_region_create(size_t chunk_size);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+mm_region_mark_t mm_region_mark(mm_region_t *region);
+void mm_region_rollback(mm_region_t *region, mm_region_mark_t mark);
+void mm_region_reset(mm_region_t *region);
+void mm_region_destroy(mm_region_t *region);
+
+/* Bytes the block at ptr can hold (malloc_usable_size) */
+size_t mm_usable_size(void *ptr);
+
+/* Lock everything around fork(); register with pthread_atfork */
+void mm_prefork(void);
+void mm_postfork(void);
+
+/* Bytes of memory currently held from the system */
+size_t mm_footprint(void);
+
+/* Check the heap for consistency; 0 if it is, -1 (and a dump) if not */
+int mm_checkheap(void);
+
+/* Tunables for mm_mallopt */
+enum {
+    MM_MMAP_THRESHOLD,      // Requests of at least this many bytes get their own mapping (128 KiB)
+    MM_TRIM_THRESHOLD,      // A free block this large ending a heap is returned to the system (128 KiB)
+    MM_GROW_MIN,            // Least a heap grows by on a miss (4 KiB)
+    MM_GROW_MAX,            // Most a heap grows by beyond the request on a miss (1 MiB)
+    MM_PLACEMENT,           // Free-list placement policy, one of MM_PLACE_* (MM_PLACE_LIFO)
+    MM_BEST_OF,             // Fitting blocks MM_PLACE_BEST_OF looks at (8)
+    MM_DECAY_MS,            // Free pages untouched this long go back to the system (1000 ms)
+    MM_PROF_SAMPLE,         // Heap profiler samples one allocation per this many bytes on average; 0 is off (0)
+    MM_HUGEPAGES,           // Nonzero: back heaps with huge pages (THP, else hugetlbfs) from mm_init on (0)
+};
+
+/* Placement policies for MM_PLACEMENT; they take effect at mm_init */
+enum {
+    MM_PLACE_LIFO,          // Freed blocks go first; first fit
+    MM_PLACE_FIFO,          // Freed blocks go last; first fit
+    MM_PLACE_ADDRESS,       // Lists kept in address order; lowest block that fits
+    MM_PLACE_NEXT_FIT,      // First fit from where the last search stopped
+    MM_PLACE_BEST_OF,       // Smallest of the first MM_BEST_OF blocks that fit
+};
+
+int mm_mallopt(int param, size_t value);
+
+/* Write the heap profiler's live samples per call stack to path, for pprof */
+int mm_prof_dump(const char *path);
+
+/* Latency histogram buckets in struct mm_stats */
+#define MM_STATS_BUCKETS 32
+
+/* What mm_stats reports; only collected when built with -DMM_STATS */
+struct mm_stats
+{
+    size_t heap_bytes;          // Bytes in all heaps
+    size_t allocated_bytes;     // Heap bytes not free, plus slab slots and mapped blocks in use
+    size_t free_bytes;          // Bytes in free heap blocks
+    size_t free_blocks;         // Number of free heap blocks
+    size_t mmap_bytes;          // Bytes of blocks mapped on their own
+    size_t huge_bytes;          // Heap bytes the kernel backs with huge pages
+
+    uint64_t fit_searches;      // Free list searches; fit_steps / fit_searches is the mean length
+    uint64_t fit_steps;         // Free blocks looked at by all searches
+    uint64_t fit_max_steps;     // Most free blocks looked at by one search
+
+    uint64_t extend_calls;      // Times a heap grew
+    uint64_t extend_bytes;      // Bytes it grew by
+
+    uint64_t coalesces;         // Merges of a free block with a free neighbour
+    uint64_t splits;            // Blocks split in two
+
+    size_t purged_bytes;        // Bytes of free blocks given back with madvise; not resident
+    uint64_t purges;            // madvise calls made to do so
+
+    uint64_t remote_frees;      // Blocks freed by a thread of another arena, without its lock
+
+    // Bucket i counts calls taking [2^(i-1), 2^i) cycles, the last one also all slower calls
+    uint64_t malloc_cycles[MM_STATS_BUCKETS];
+    uint64_t free_cycles[MM_STATS_BUCKETS];
+};
+
+int mm_stats(struct mm_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_H */
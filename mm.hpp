@@ -0,0 +1,152 @@
+/*
+ * mm.hpp - C++ adapters for the malloc package, so containers can use it
+ *          directly instead of through the global operator new:
+ *
+ *              std::vector<int, mm::allocator<int>> v;
+ *              std::pmr::unordered_map<int, int> m(mm::resource());
+ *
+ *          mm::allocator<T> meets the standard Allocator requirements and
+ *          mm::memory_resource is a std::pmr::memory_resource. Both hand
+ *          the size and alignment they are given back to mm_free_sized and
+ *          mm_free_aligned_sized when deallocating. Call mm_init before
+ *          allocating, as for the C interface.
+ */
+#ifndef MM_HPP
+#define MM_HPP
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <memory_resource>
+
+#include "mm.h"
+
+namespace mm {
+
+/* Alignment every mm_malloc block has */
+constexpr std::size_t malloc_alignment = 16;
+
+/*
+ * allocate_bytes - size bytes aligned to alignment (a power of two), or
+ *                  std::bad_alloc. A request of 0 bytes still gets a block.
+ */
+inline void *allocate_bytes(std::size_t size, std::size_t alignment)
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    void *ptr = alignment <= malloc_alignment ? mm_malloc(size)
+                                              : mm_aligned_alloc(alignment, size);
+
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+/*
+ * deallocate_bytes - Free a block from allocate_bytes(size, alignment).
+ */
+inline void deallocate_bytes(void *ptr, std::size_t size, std::size_t alignment) noexcept
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (alignment <= malloc_alignment) {
+        mm_free_sized(ptr, size);
+    } else {
+        mm_free_aligned_sized(ptr, alignment, size);
+    }
+}
+
+/*
+ * allocator - Standard allocator on the malloc package. It has no state,
+ *             so all of them compare equal and can free each other's
+ *             memory.
+ */
+template <class T>
+class allocator
+{
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U> &) noexcept
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        deallocate_bytes(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return false;
+}
+
+/*
+ * memory_resource - std::pmr::memory_resource on the malloc package, as
+ *                   upstream for pmr pools or for pmr containers as is.
+ *                   Any two of them are interchangeable.
+ */
+class memory_resource : public std::pmr::memory_resource
+{
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return allocate_bytes(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        deallocate_bytes(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const memory_resource *>(&other) != nullptr;
+    }
+};
+
+/*
+ * resource - A process-wide mm::memory_resource, e.g. for
+ *            std::pmr::set_default_resource(mm::resource()). It is never
+ *            destroyed, so static containers can still free into it at
+ *            exit.
+ */
+inline memory_resource *resource() noexcept
+{
+    alignas(memory_resource) static unsigned char storage[sizeof(memory_resource)];
+    static memory_resource *instance = ::new (storage) memory_resource();
+
+    return instance;
+}
+
+} // namespace mm
+
+#endif /* MM_HPP */
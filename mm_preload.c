@@ -0,0 +1,306 @@
+/*
+ * mm_preload.c - the libc allocation API on top of the malloc package, for
+ *                libmm.so. Run any program on the allocator with
+ *
+ *                    LD_PRELOAD=./libmm.so prog args...
+ *
+ * The first call into any of these functions sets up the simulated heap
+ * and the allocator. Set-up can itself allocate (pthread_atfork, a first
+ * pthread_once), so calls made by the initializing thread while it is in
+ * progress are served from a small static bootstrap area; other threads
+ * wait for it to finish. Bootstrap blocks are never freed.
+ *
+ * Every lock the allocator holds is taken before fork() and released
+ * after it in both processes, so a child of a threaded program can
+ * allocate.
+ *
+ * MM_PROF_SAMPLE=bytes in the environment turns the heap profiler on, and
+ * MM_PROF_DUMP=path writes its profile there when the program exits.
+ * MM_HUGEPAGES=1 backs the heaps with huge pages.
+ *
+ * Build with MM_THREAD_SAFE; the Makefile's libmm.so target does.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+enum { INIT_NONE, INIT_RUNNING, INIT_DONE };
+
+static int init_state = INIT_NONE;
+static pthread_t init_thread;
+
+// Bootstrap area for allocations made while initializing (bytes)
+#define BOOT_SIZE (64 * 1024)
+
+static _Alignas(16) unsigned char boot_area[BOOT_SIZE];
+static size_t boot_used;
+
+// Where to write the heap profile at exit (MM_PROF_DUMP)
+static const char *prof_dump_path;
+
+/*
+ * boot_alloc - Bump allocation from the bootstrap area. Each block is
+ *              preceded by 16 bytes holding its size, for realloc and
+ *              malloc_usable_size.
+ */
+static void *boot_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t) 15;
+    if (size > BOOT_SIZE - 16 - boot_used) {
+        return NULL;
+    }
+
+    unsigned char *p = boot_area + boot_used;
+
+    *(size_t *) p = size;
+    boot_used += size + 16;
+    return p + 16;
+}
+
+/*
+ * boot_owns - Whether ptr came from boot_alloc.
+ */
+static int boot_owns(const void *ptr)
+{
+    const unsigned char *p = ptr;
+
+    return p >= boot_area && p < boot_area + BOOT_SIZE;
+}
+
+static size_t boot_size(const void *ptr)
+{
+    return *(const size_t *) ((const unsigned char *) ptr - 16);
+}
+
+/*
+ * prof_dump_at_exit - atexit handler writing the heap profile.
+ */
+static void prof_dump_at_exit(void)
+{
+    mm_prof_dump(prof_dump_path);
+}
+
+/*
+ * prof_setup - Apply the MM_PROF_* environment variables.
+ */
+static void prof_setup(void)
+{
+    const char *sample = getenv("MM_PROF_SAMPLE");
+
+    if (sample != NULL) {
+        mm_mallopt(MM_PROF_SAMPLE, strtoull(sample, NULL, 0));
+    }
+
+    prof_dump_path = getenv("MM_PROF_DUMP");
+    if (prof_dump_path != NULL) {
+        atexit(prof_dump_at_exit);
+    }
+}
+
+/*
+ * ensure_init - Returns 1 once the allocator is usable by this thread, or
+ *               0 if this thread is the one setting it up, in which case
+ *               the caller falls back to the bootstrap area.
+ */
+static int ensure_init(void)
+{
+    int state = __atomic_load_n(&init_state, __ATOMIC_ACQUIRE);
+
+    if (state == INIT_DONE) {
+        return 1;
+    }
+
+    int expected = INIT_NONE;
+
+    if (__atomic_compare_exchange_n(&init_state, &expected, INIT_RUNNING, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        init_thread = pthread_self();
+
+        const char *huge = getenv("MM_HUGEPAGES");
+
+        if (huge != NULL) {
+            mm_mallopt(MM_HUGEPAGES, strtoull(huge, NULL, 0));
+        }
+
+        mem_init();
+        if (mm_init() < 0) {
+            abort();
+        }
+        pthread_atfork(mm_prefork, mm_postfork, mm_postfork);
+        prof_setup();
+        __atomic_store_n(&init_state, INIT_DONE, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    if (pthread_equal(init_thread, pthread_self())) {
+        return 0;
+    }
+
+    while (__atomic_load_n(&init_state, __ATOMIC_ACQUIRE) != INIT_DONE) {
+        sched_yield();
+    }
+    return 1;
+}
+
+/*
+ * nomem - Sets errno for a failed allocation; returns NULL.
+ */
+static void *nomem(void)
+{
+    errno = ENOMEM;
+    return NULL;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    if (!ensure_init()) {
+        return boot_alloc(size);
+    }
+
+    void *ptr = mm_malloc(size ? size : 1);
+
+    return ptr != NULL ? ptr : nomem();
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr == NULL || boot_owns(ptr)) {
+        return;
+    }
+    mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    size_t bytes;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        return nomem();
+    }
+
+    if (!ensure_init()) {
+        return boot_alloc(bytes);       // Static storage; already zero
+    }
+
+    void *ptr = bytes != 0 ? mm_calloc(nmemb, size) : mm_calloc(1, 1);
+
+    return ptr != NULL ? ptr : nomem();
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return malloc(size);
+    }
+
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (boot_owns(ptr)) {
+        size_t old = boot_size(ptr);
+        void *copy = malloc(size);
+
+        if (copy != NULL) {
+            memcpy(copy, ptr, old < size ? old : size);
+        }
+        return copy;
+    }
+
+    void *copy = mm_realloc(ptr, size);
+
+    return copy != NULL ? copy : nomem();
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    size_t bytes;
+
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        return nomem();
+    }
+    return realloc(ptr, bytes);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!ensure_init()) {
+        if (alignment > 16) {
+            return ENOMEM;
+        }
+        *memptr = boot_alloc(size);
+        return *memptr != NULL ? 0 : ENOMEM;
+    }
+
+    return mm_posix_memalign(memptr, alignment, size ? size : 1);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    void *ptr;
+    int err;
+
+    /* glibc rounds a bad alignment up to a power of two instead of failing,
+       unless there is none that large */
+    if (alignment > SIZE_MAX / 2 + 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment & (alignment - 1)) {
+        alignment = (size_t) 1 << (64 - __builtin_clzl(alignment));
+    }
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+
+    err = posix_memalign(&ptr, alignment, size);
+    if (err != 0) {
+        errno = err;
+        return NULL;
+    }
+    return ptr;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    if (size > SIZE_MAX - (page - 1)) {
+        return nomem();
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    if (ptr != NULL && boot_owns(ptr)) {
+        return boot_size(ptr);
+    }
+    return mm_usable_size(ptr);
+}
@@ -0,0 +1,166 @@
+/*
+ * mm_preload_new.cc - C++ operator new and delete for libmm.so, so that
+ *                     the C++ runtime's allocations go to the malloc
+ *                     package too. Every replaceable form is defined,
+ *                     including the sized and aligned ones, so none falls
+ *                     through to libstdc++'s own, which would pair it with
+ *                     a different free. They go through mm_preload.c's
+ *                     malloc and free, which set the allocator up on first
+ *                     use.
+ */
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+
+namespace {
+
+/*
+ * new_size - operator new(0) still returns a distinct pointer.
+ */
+inline std::size_t new_size(std::size_t size)
+{
+    return size != 0 ? size : 1;
+}
+
+/*
+ * allocate - What operator new does: retry through the new_handler until
+ *            the allocation succeeds, throwing bad_alloc if there is none.
+ */
+void *allocate(std::size_t size, std::size_t alignment)
+{
+    for (;;) {
+        void *ptr = nullptr;
+
+        if (alignment <= alignof(std::max_align_t)) {
+            ptr = std::malloc(new_size(size));
+        } else if (posix_memalign(&ptr, alignment, new_size(size)) != 0) {
+            ptr = nullptr;
+        }
+
+        if (ptr != nullptr) {
+            return ptr;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void *allocate_nothrow(std::size_t size, std::size_t alignment) noexcept
+{
+    try {
+        return allocate(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+} // namespace
+
+#pragma GCC visibility push(default)
+
+void *operator new(std::size_t size)
+{
+    return allocate(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+    return allocate(size, 0);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_nothrow(size, 0);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate_nothrow(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t al)
+{
+    return allocate(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al)
+{
+    return allocate(size, static_cast<std::size_t>(al));
+}
+
+void *operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return allocate_nothrow(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return allocate_nothrow(size, static_cast<std::size_t>(al));
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+#pragma GCC visibility pop
@@ -0,0 +1,531 @@
+/*
+ * mtbench.c - Multithreaded benchmarks for the malloc package.
+ *
+ * Runs synthetic concurrent workloads against mm.c (built with
+ * MM_THREAD_SAFE) and against the C library's malloc, at 1, 2, 4, ...
+ * threads up to a maximum, and reports millions of operations per second
+ * (an operation is one malloc or free, or for falseshare one update):
+ *
+ *   larson      server churn: each thread frees and reallocates random
+ *               slots of its own array of blocks; between rounds the
+ *               arrays move on to the next thread, so blocks are freed by
+ *               a thread other than the one that allocated them
+ *   prodcons    every thread allocates messages into a ring that the next
+ *               thread drains and frees, so every free is cross-thread
+ *   pingpong    each thread allocates and frees batches of one size class
+ *               after another, so memory has to move between classes
+ *   falseshare  threads allocate small objects in lockstep and then
+ *               update only their own; also counts the cache lines that
+ *               ended up holding objects of different threads
+ *
+ * Each thread does the same amount of work whatever the thread count, so
+ * a scalable allocator keeps the per-thread rate as threads are added
+ * (on as many CPUs).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#ifndef MM_THREAD_SAFE
+#error "mtbench needs mm.c built with -DMM_THREAD_SAFE"
+#endif
+
+// Work per thread, multiplied by -s
+#define LARSON_SLOTS 1000
+#define LARSON_ROUNDS 10
+#define LARSON_STEPS 50000
+#define PRODCONS_MESSAGES 200000
+#define PINGPONG_BATCHES 20000
+#define PINGPONG_BATCH 64
+#define FALSESHARE_OBJECTS 4
+#define FALSESHARE_UPDATES 5000000
+
+// Capacity of a prodcons ring (a power of two)
+#define RING_SIZE 256
+
+#define CACHE_LINE 64
+
+/* An allocator under test */
+typedef struct
+{
+    const char *name;
+    void (*reset)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+} allocator_t;
+
+/* Single-producer single-consumer ring of messages */
+typedef struct
+{
+    void *slots[RING_SIZE];
+    _Alignas(CACHE_LINE) unsigned head;     // Written by the producer
+    _Alignas(CACHE_LINE) unsigned tail;     // Written by the consumer
+} ring_t;
+
+/* One benchmark run: an allocator at a thread count */
+typedef struct
+{
+    const allocator_t *alloc;
+    unsigned nthreads;
+    unsigned scale;
+    pthread_barrier_t start;    // Workers and the timing thread
+    pthread_barrier_t round;    // Workers only, between larson rounds
+
+    void ***larson_slots;       // Per thread, moved on between rounds
+    ring_t *rings;              // rings[i] is written by thread i
+    void **objects;             // falseshare: FALSESHARE_OBJECTS per thread
+} run_t;
+
+typedef struct
+{
+    pthread_t thread;
+    unsigned id;
+    run_t *run;
+    uint64_t ops;
+    uint64_t rng;
+} worker_t;
+
+typedef struct
+{
+    const char *name;
+    void *(*work)(void *arg);
+} bench_t;
+
+static void mm_reset(void);
+static void libc_reset(void);
+
+static void *larson(void *arg);
+static void *prodcons(void *arg);
+static void *pingpong(void *arg);
+static void *falseshare(void *arg);
+
+static double run_bench(const bench_t *bench, const allocator_t *alloc,
+                        unsigned nthreads, unsigned scale, size_t *shared_lines);
+static size_t count_shared_lines(void **objects, unsigned nthreads);
+static size_t random_size(worker_t *w, size_t lo, size_t hi);
+static double now(void);
+
+static const allocator_t mm_allocator = { "mm", mm_reset, mm_malloc, mm_free };
+static const allocator_t libc_allocator = { "libc", libc_reset, malloc, free };
+
+static const bench_t benches[] = {
+    { "larson", larson },
+    { "prodcons", prodcons },
+    { "pingpong", pingpong },
+    { "falseshare", falseshare },
+};
+
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-L] [-t threads] [-s scale] [bench...]\n"
+            "  -L          do not run the C library's malloc\n"
+            "  -t threads  most threads to run with (default: online CPUs)\n"
+            "  -s scale    multiply the work per thread (default 1)\n"
+            "  bench       larson, prodcons, pingpong or falseshare (default all)\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bool with_libc = true;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned scale = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "Lt:s:h")) != -1) {
+        switch (opt) {
+        case 'L':
+            with_libc = false;
+            break;
+        case 't':
+            max_threads = atol(optarg);
+            if (max_threads < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            scale = (unsigned) atoi(optarg);
+            if (scale < 1) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+
+    bool selected[NBENCHES];
+
+    memset(selected, optind == argc, sizeof(selected));
+    for (int i = optind; i < argc; i++) {
+        size_t b = 0;
+
+        while (b < NBENCHES && strcmp(argv[i], benches[b].name) != 0) {
+            b++;
+        }
+        if (b == NBENCHES) {
+            usage(argv[0]);
+        }
+        selected[b] = true;
+    }
+
+    mem_init();
+
+    printf("%-12s %8s %12s %12s %10s\n", "bench", "threads", "mm Mops/s", "libc Mops/s", "mm/libc");
+
+    for (size_t b = 0; b < NBENCHES; b++) {
+        if (!selected[b]) {
+            continue;
+        }
+
+        // 1, 2, 4, ... and max_threads itself
+        for (unsigned t = 1; ; t *= 2) {
+            if (t > max_threads) {
+                t = (unsigned) max_threads;
+            }
+
+            size_t mm_shared = 0, libc_shared = 0;
+            double mm_rate = run_bench(&benches[b], &mm_allocator, t, scale, &mm_shared);
+            double libc_rate = with_libc ? run_bench(&benches[b], &libc_allocator, t, scale, &libc_shared) : 0;
+
+            printf("%-12s %8u %12.2f ", benches[b].name, t, mm_rate / 1e6);
+            if (with_libc) {
+                printf("%12.2f %9.2fx", libc_rate / 1e6, mm_rate / libc_rate);
+            } else {
+                printf("%12s %10s", "-", "-");
+            }
+            if (benches[b].work == falseshare) {
+                printf("   shared lines: mm %zu", mm_shared);
+                if (with_libc) {
+                    printf(", libc %zu", libc_shared);
+                }
+            }
+            printf("\n");
+
+            if (t == max_threads) {
+                break;
+            }
+        }
+    }
+
+    mem_deinit();
+
+    return 0;
+}
+
+/*
+ * run_bench - Run bench on nthreads threads with alloc and return the
+ *             operations per second, counted from when all threads are
+ *             ready to when the last one is done. For falseshare, also
+ *             stores in *shared_lines how many cache lines hold objects
+ *             of more than one thread.
+ */
+static double run_bench(const bench_t *bench, const allocator_t *alloc,
+                        unsigned nthreads, unsigned scale, size_t *shared_lines)
+{
+    run_t run = { .alloc = alloc, .nthreads = nthreads, .scale = scale };
+    worker_t *workers = calloc(nthreads, sizeof(*workers));
+
+    run.larson_slots = calloc(nthreads, sizeof(*run.larson_slots));
+    run.rings = aligned_alloc(CACHE_LINE, nthreads * sizeof(*run.rings));
+    run.objects = calloc((size_t) nthreads * FALSESHARE_OBJECTS, sizeof(*run.objects));
+    if (workers == NULL || run.larson_slots == NULL || run.rings == NULL || run.objects == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(run.rings, 0, nthreads * sizeof(*run.rings));
+
+    alloc->reset();
+
+    pthread_barrier_init(&run.start, NULL, nthreads + 1);
+    pthread_barrier_init(&run.round, NULL, nthreads);
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].run = &run;
+        workers[i].rng = 0x9E3779B97F4A7C15u * (i + 1);
+        if (pthread_create(&workers[i].thread, NULL, bench->work, &workers[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&run.start);
+    double start = now();
+
+    uint64_t ops = 0;
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+    }
+
+    double elapsed = now() - start;
+
+    if (bench->work == falseshare) {
+        *shared_lines = count_shared_lines(run.objects, nthreads);
+        for (size_t i = 0; i < (size_t) nthreads * FALSESHARE_OBJECTS; i++) {
+            alloc->free(run.objects[i]);
+        }
+    }
+
+    pthread_barrier_destroy(&run.start);
+    pthread_barrier_destroy(&run.round);
+    free(run.larson_slots);
+    free(run.rings);
+    free(run.objects);
+    free(workers);
+
+    return ops / elapsed;
+}
+
+/*
+ * larson - Replace random blocks of a slot array, one round at a time;
+ *          after each round take over the array of the previous thread.
+ */
+static void *larson(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    const allocator_t *alloc = run->alloc;
+    void **slots = malloc(LARSON_SLOTS * sizeof(*slots));
+
+    for (size_t i = 0; i < LARSON_SLOTS; i++) {
+        slots[i] = alloc->malloc(random_size(w, 16, 256));
+    }
+    run->larson_slots[w->id] = slots;
+
+    pthread_barrier_wait(&run->start);
+
+    for (unsigned round = 0; round < LARSON_ROUNDS; round++) {
+        for (size_t step = 0; step < (size_t) LARSON_STEPS * run->scale; step++) {
+            size_t i = random_size(w, 0, LARSON_SLOTS - 1);
+
+            alloc->free(slots[i]);
+            slots[i] = alloc->malloc(random_size(w, 16, 256));
+            *(char *) slots[i] = 1;
+        }
+        w->ops += 2 * (uint64_t) LARSON_STEPS * run->scale;
+
+        pthread_barrier_wait(&run->round);
+        slots = run->larson_slots[(w->id + 1) % run->nthreads];
+        pthread_barrier_wait(&run->round);
+        run->larson_slots[w->id] = slots;
+        pthread_barrier_wait(&run->round);
+    }
+
+    for (size_t i = 0; i < LARSON_SLOTS; i++) {
+        alloc->free(slots[i]);
+    }
+    free(slots);
+
+    return NULL;
+}
+
+/*
+ * prodcons - Allocate messages into this thread's ring while draining and
+ *            freeing those of the previous thread's ring.
+ */
+static void *prodcons(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    const allocator_t *alloc = run->alloc;
+    ring_t *out = &run->rings[w->id];
+    ring_t *in = &run->rings[(w->id + run->nthreads - 1) % run->nthreads];
+    size_t total = (size_t) PRODCONS_MESSAGES * run->scale;
+    size_t produced = 0, consumed = 0;
+
+    pthread_barrier_wait(&run->start);
+
+    while (produced < total || consumed < total) {
+        bool progress = false;
+
+        // Fill the ring up
+        unsigned head = out->head;
+        unsigned room = RING_SIZE - (head - __atomic_load_n(&out->tail, __ATOMIC_ACQUIRE));
+
+        while (room-- > 0 && produced < total) {
+            char *msg = alloc->malloc(random_size(w, 16, 512));
+
+            msg[0] = 1;
+            out->slots[head++ % RING_SIZE] = msg;
+            produced++;
+            progress = true;
+        }
+        __atomic_store_n(&out->head, head, __ATOMIC_RELEASE);
+
+        // Drain the other
+        unsigned tail = in->tail;
+        unsigned avail = __atomic_load_n(&in->head, __ATOMIC_ACQUIRE) - tail;
+
+        while (avail-- > 0) {
+            alloc->free(in->slots[tail++ % RING_SIZE]);
+            consumed++;
+            progress = true;
+        }
+        __atomic_store_n(&in->tail, tail, __ATOMIC_RELEASE);
+
+        if (!progress) {
+            sched_yield();
+        }
+    }
+
+    w->ops = 2 * (uint64_t) total;
+
+    return NULL;
+}
+
+/*
+ * pingpong - Allocate and free batches of one size class after another.
+ */
+static void *pingpong(void *arg)
+{
+    static const size_t sizes[] = { 16, 48, 112, 240, 496, 1008, 2032, 4080 };
+    worker_t *w = arg;
+    run_t *run = w->run;
+    const allocator_t *alloc = run->alloc;
+    void *batch[PINGPONG_BATCH];
+    size_t nbatches = (size_t) PINGPONG_BATCHES * run->scale;
+
+    pthread_barrier_wait(&run->start);
+
+    for (size_t b = 0; b < nbatches; b++) {
+        size_t size = sizes[b % (sizeof(sizes) / sizeof(sizes[0]))];
+
+        for (size_t i = 0; i < PINGPONG_BATCH; i++) {
+            batch[i] = alloc->malloc(size);
+            *(char *) batch[i] = 1;
+        }
+        for (size_t i = 0; i < PINGPONG_BATCH; i++) {
+            alloc->free(batch[i]);
+        }
+    }
+
+    w->ops = 2 * (uint64_t) nbatches * PINGPONG_BATCH;
+
+    return NULL;
+}
+
+/*
+ * falseshare - Allocate FALSESHARE_OBJECTS small counters, one per step
+ *              in lockstep with the other threads, then update only them.
+ *              Slow if the allocator put them on other threads' lines.
+ */
+static void *falseshare(void *arg)
+{
+    worker_t *w = arg;
+    run_t *run = w->run;
+    volatile uint64_t *mine[FALSESHARE_OBJECTS];
+    size_t updates = (size_t) FALSESHARE_UPDATES * run->scale;
+
+    for (size_t i = 0; i < FALSESHARE_OBJECTS; i++) {
+        pthread_barrier_wait(&run->round);
+        mine[i] = run->alloc->malloc(sizeof(uint64_t));
+        *mine[i] = 0;
+        run->objects[w->id * FALSESHARE_OBJECTS + i] = (void *) mine[i];
+    }
+
+    pthread_barrier_wait(&run->start);
+
+    for (size_t n = 0; n < updates; n++) {
+        (*mine[n % FALSESHARE_OBJECTS])++;
+    }
+
+    w->ops = updates;
+
+    return NULL;
+}
+
+/*
+ * count_shared_lines - Returns how many cache lines hold falseshare
+ *                      objects of more than one thread.
+ */
+static size_t count_shared_lines(void **objects, unsigned nthreads)
+{
+    size_t n = (size_t) nthreads * FALSESHARE_OBJECTS;
+    size_t shared = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uintptr_t line = (uintptr_t) objects[i] / CACHE_LINE;
+        bool first = true;          // Count each line once, at its first object
+        bool other = false;
+
+        for (size_t j = 0; j < n; j++) {
+            if ((uintptr_t) objects[j] / CACHE_LINE != line) {
+                continue;
+            }
+            if (j < i) {
+                first = false;
+            }
+            if (j / FALSESHARE_OBJECTS != i / FALSESHARE_OBJECTS) {
+                other = true;
+            }
+        }
+
+        if (first && other) {
+            shared++;
+        }
+    }
+
+    return shared;
+}
+
+/*
+ * random_size - Returns a pseudo-random number in [lo, hi] from the
+ *               worker's own generator.
+ */
+static size_t random_size(worker_t *w, size_t lo, size_t hi)
+{
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return lo + w->rng % (hi - lo + 1);
+}
+
+/*
+ * mm_reset - Start mm.c over on an empty heap.
+ */
+static void mm_reset(void)
+{
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+/*
+ * libc_reset - Nothing to do; every block was freed after the last run.
+ */
+static void libc_reset(void)
+{
+}
+
+/*
+ * now - Returns a monotonic clock reading in seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}